@@ -63,8 +63,10 @@ sub exists_record {
     return ($count > 0) ? 1 : 0;
 }
 
+# the hashes are kept in hex. the reported clones are kept with their code deparsed
+# by materialize_src, and the others with their code as the detector has kept it
 sub update_record {
-    my ($self, $all_data) = @_;
+    my ($self, $all_data, $detector) = @_;
     my $rev = '';
     foreach my $data (@$all_data) {
         eval {
@@ -74,9 +76,9 @@ sub update_record {
                 start_line => $data->{start_line},
                 end_line   => $data->{end_line},
                 token_num  => $data->{token_num},
-                src        => $data->{src},
-                hash       => $data->{hash},
-                parents    => encode_json($data->{parents}),
+                src        => $detector->src_of($data),
+                hash       => unpack('H*', $data->{hash}),
+                parents    => encode_json([ map { unpack('H*', $_) } @{$data->{parents}} ]),
             });
         };
         print $@ if ($@);
@@ -96,8 +98,8 @@ sub read_record {
             end_line   => $row->end_line,
             token_num  => $row->token_num,
             src        => $row->src,
-            hash       => $row->hash,
-            parents    => decode_json($row->parents)
+            hash       => pack('H*', $row->hash),
+            parents    => [ map { pack('H*', $_) } @{decode_json($row->parents)} ]
         });
     }
     return \@records;
@@ -178,7 +180,9 @@ sub exec_copy_paste_detector {
     my $time = $created_at;
     $time =~ s/\s/_/g;
     $self->{options}->{output_dirname} = "${time}_${rev}";
-    my $detector = Compiler::Tools::CopyPasteDetector->new($self->{options});
+    # the deparse workers of the previous revision are reused
+    my $detector = Compiler::Tools::CopyPasteDetector->new({ %{$self->{options}}, engine => $self->{engine} });
+    $self->{engine} = $detector->engine;
     my $all_files = $detector->get_target_files_by_project_root($self->{root});
     my (@data, %not_evaluated_files);
     foreach my $file (@$all_files) {
@@ -191,12 +195,13 @@ sub exec_copy_paste_detector {
         }
     }
     my @names = keys %not_evaluated_files;
-    if (@names) {
-        my $record = $detector->detect(\@names);
-        $self->update_record($record);
-        push(@data, @$record);
-    }
+    my $record = (@names) ? $detector->detect(\@names) : [];
+    push(@data, @$record);
     my $score = $detector->get_score(\@data);
+    # only the clones reported by the score are deparsed from their source
+    my %is_reported = map { ($_ => 1) } map { @{$_->{set}} } @{$score->{clone_set_score}};
+    $detector->materialize_src($_) foreach (grep { $is_reported{$_} } @$record);
+    $self->update_record($record, $detector);
     my $directory_score = $score->{directory_score};
     my @observe_names = grep {
         exists $self->{namespaces}->{$_};
@@ -36,13 +36,11 @@ foreach my $file (@$files) {
     }
 }
 
-if (@not_evaluated_files) {
-    my $record = $detector->detect(\@not_evaluated_files);
-    $detector->insert_record($record);
-    push(@data, @$record);
-}
+my $record = (@not_evaluated_files) ? $detector->detect(\@not_evaluated_files) : [];
+push(@data, @$record);
 
 my $score = $detector->get_score(\@data);
+$detector->insert_record($record, $score);
 $detector->display($score);
 $detector->gen_html($score);
 
@@ -30,9 +30,13 @@ sub exists_record {
     return ($count > 0) ? 1 : 0;
 }
 
+# the reported clones of the score are kept with their code deparsed by materialize_src,
+# and the others with their code as the detector has kept it. the hashes are kept in hex
 sub insert_record {
-    my ($self, $all_data) = @_;
+    my ($self, $all_data, $score) = @_;
     my $rev = '';
+    my %is_reported = map { ($_ => 1) } map { @{$_->{set}} } @{$score->{clone_set_score}};
+    $self->materialize_src($_) foreach (grep { $is_reported{$_} } @$all_data);
     foreach my $data (@$all_data) {
         eval {
         $self->{db}->insert('copy_and_paste_record', {
@@ -41,9 +45,9 @@ sub insert_record {
             start_line => $data->{start_line},
             end_line   => $data->{end_line},
             token_num  => $data->{token_num},
-            src        => $data->{src},
-            hash       => $data->{hash},
-            parents    => encode_json($data->{parents}),
+            src        => $self->src_of($data),
+            hash       => unpack('H*', $data->{hash}),
+            parents    => encode_json([ map { unpack('H*', $_) } @{$data->{parents}} ]),
             revision   => ''
         });
         };
@@ -65,8 +69,8 @@ sub read_record {
             end_line   => $row->end_line,
             token_num  => $row->token_num,
             src        => $row->src,
-            hash       => $row->hash,
-            parents    => decode_json($row->parents)
+            hash       => pack('H*', $row->hash),
+            parents    => [ map { pack('H*', $_) } @{decode_json($row->parents)} ]
         });
     }
     return \@records;
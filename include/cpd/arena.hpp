@@ -0,0 +1,32 @@
+#ifndef CPD_ARENA_HPP
+#define CPD_ARENA_HPP
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/*
+ * A bump allocator for the records of a detection and their strings.
+ * Nothing is freed one by one: the chunks are freed at once with the arena,
+ * so the records must not own anything outside of it. An arena is used
+ * by one thread at a time.
+ */
+class Arena {
+public:
+	Arena(size_t chunk_size_ = ARENA_CHUNK_SIZE);
+	~Arena(void);
+	/* aligned for any record */
+	void *allocate(size_t size);
+	const char *copy(const char *data, size_t size);
+	const char *copy(const std::string &data) { return copy(data.c_str(), data.size()); }
+private:
+	size_t chunk_size;
+	std::vector<char *> chunks;
+	char *current; /* the free space of the last chunk */
+	size_t left;
+	Arena(const Arena &);
+	Arena &operator=(const Arena &);
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef CPD_CPU_QUOTA_HPP
+#define CPD_CPU_QUOTA_HPP
+#include <stddef.h>
+
+/*
+ * Returns the number of the CPUs this process may keep busy: the online
+ * CPUs, narrowed by the CPU affinity and by the CPU quota of the cgroup
+ * (cpu.max of v2, or cpu.cfs_quota_us / cpu.cfs_period_us of v1).
+ * A fractional quota is rounded up, and the result is 1 at least.
+ */
+size_t available_cpu_num(void);
+
+#endif
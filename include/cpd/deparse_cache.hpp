@@ -0,0 +1,93 @@
+#ifndef CPD_DEPARSE_CACHE_HPP
+#define CPD_DEPARSE_CACHE_HPP
+#include <cpd/deparser.hpp>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define DEPARSE_CACHE_KEY_SIZE 16
+#define DEPARSE_CACHE_HASH_SIZE 32
+
+/*
+ * <cache_dir>/index is an open addressing hash table of DeparseCacheSlot
+ * after the header, and <cache_dir>/data.<data_id> is the deparsed code
+ * appended by each run. Both are written in the native byte order. A
+ * compaction writes a data file of a new data_id, so the index is the only
+ * file replaced, and an index always refers to the data file it was made with.
+ */
+typedef struct _DeparseCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t capacity;   /* number of slots (power of 2) */
+	uint32_t count;
+	uint32_t generation; /* incremented by each run which commits */
+	uint64_t data_size;  /* bytes of the data file referred by the slots */
+	uint32_t data_id;    /* of the data file */
+} DeparseCacheHeader;
+
+typedef struct _DeparseCacheSlot {
+	unsigned char key[DEPARSE_CACHE_KEY_SIZE];
+	char hash[DEPARSE_CACHE_HASH_SIZE]; /* md5 of the code without the last newline */
+	uint64_t offset;
+	uint32_t size;
+	uint32_t generation; /* last run which used the code, 0 for an empty slot */
+} DeparseCacheSlot;
+
+/* md5 of the deparse command (perl, -I and -M switches), its stamp and the statement */
+class DeparseCacheKey {
+public:
+	unsigned char digest[DEPARSE_CACHE_KEY_SIZE];
+	DeparseCacheKey(const DeparseCommand *cmd, const char *src);
+};
+
+class DeparseCacheRecord {
+public:
+	std::string key;
+	std::string code;
+	std::string hash;
+};
+
+/* codes used and added by one worker thread, merged by DeparseCache::commit */
+class DeparseCacheJournal {
+public:
+	std::vector<uint32_t> used_slots;
+	std::vector<DeparseCacheRecord> records;
+	std::map<std::string, size_t> record_map;
+	size_t hit_num; /* of the codes found in the files of the cache */
+	DeparseCacheJournal(void) : hit_num(0) {}
+	/* returns the hash of the code like add_stmt() */
+	std::string add(const DeparseCacheKey &key, const std::string &code);
+};
+
+/*
+ * Deparsed statements shared across runs. The files are mapped read-only
+ * while the workers run, so lookups need no locks; new codes and the LRU
+ * generations are written by commit() after the workers finish, which
+ * drops the least recently used codes when the data exceeds max_size, and
+ * loads the files again for the next run.
+ */
+class DeparseCache {
+public:
+	std::string dir;
+	size_t max_size;
+	const char *data;
+	size_t data_size;
+	void *index;
+	size_t index_size;
+	const DeparseCacheHeader *header;
+	const DeparseCacheSlot *slots;
+	DeparseCache(const char *dir_, size_t max_size_);
+	~DeparseCache(void);
+	bool lookup(const DeparseCacheKey &key, std::string *code, std::string *hash,
+				DeparseCacheJournal *journal) const;
+	void commit(const std::vector<DeparseCacheJournal *> &journals);
+private:
+	void load(void);
+	void unload(void);
+	const DeparseCacheSlot *find(const unsigned char *key) const;
+	std::string path(const char *name) const;
+	std::string data_path(uint32_t data_id) const;
+};
+
+#endif
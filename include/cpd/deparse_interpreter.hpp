@@ -0,0 +1,41 @@
+#ifndef CPD_DEPARSE_INTERPRETER_HPP
+#define CPD_DEPARSE_INTERPRETER_HPP
+#include <cpd/deparser.hpp>
+#include <string>
+#include <vector>
+
+struct interpreter;
+struct sv;
+
+/*
+ * A perl interpreter embedded in a worker thread. It is started with the
+ * switches of its command and calls Compiler::Tools::CopyPasteDetector::Deparser
+ * directly, so there are no processes, pipes or shell quoting per statement.
+ */
+class DeparseInterpreter {
+public:
+	std::string key;
+	struct interpreter *perl;
+	struct sv *compile;
+	bool is_alive;
+	DeparseInterpreter(const DeparseCommand *cmd);
+	~DeparseInterpreter(void);
+	bool deparse(const char *src, std::string *code);
+	bool fingerprint(const char *src, bool abstracts_variables, std::string *hash);
+};
+
+/* interpreters owned by one worker thread, keyed by the deparse command */
+class DeparseInterpreterPool : public Deparser {
+public:
+	size_t max_interpreter_num;
+	bool fingerprints; /* compares statements by their op trees instead of B::Deparse */
+	bool abstracts_variables;
+	std::vector<DeparseInterpreter *> interpreters; /* least recently used first */
+	DeparseInterpreterPool(size_t max_interpreter_num_, bool fingerprints_ = false, bool abstracts_variables_ = false);
+	~DeparseInterpreterPool(void);
+	DeparseInterpreter *get(const DeparseCommand *cmd);
+	bool deparse(const DeparseCommand *cmd, const char *src, std::string *code);
+	bool fingerprint(const DeparseCommand *cmd, const char *src, std::string *hash);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef CPD_DEPARSE_SERVER_HPP
+#define CPD_DEPARSE_SERVER_HPP
+#include <cpd/deparser.hpp>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/*
+ * A long-lived perl process running Compiler::Tools::CopyPasteDetector::DeparseServer.
+ * It keeps the modules of its command loaded, so statements are deparsed
+ * without launching perl each time. See DeparseServer.pm for the protocol.
+ */
+class DeparseServer {
+public:
+	std::vector<std::string> argv;
+	pid_t pid;
+	int writer;
+	int reader;
+	bool is_alive;
+	std::vector<char> buf;
+	size_t buf_begin;
+	size_t buf_end;
+	DeparseServer(const std::vector<std::string> &argv_);
+	/* a connection to a server forked by a Zygote */
+	DeparseServer(int fd);
+	~DeparseServer(void);
+	/* returns false if the statement must be deparsed by 'perl -MO=Deparse' */
+	bool deparse(const char *src, std::string *code);
+private:
+	void shutdown(void);
+	bool write_all(const char *data, size_t size);
+	bool fill(void);
+	bool read_line(std::string *line);
+	bool read_exact(size_t size, std::string *data);
+};
+
+/* servers owned by one worker thread, keyed by the argv of the server command */
+class DeparseServerPool : public Deparser {
+public:
+	size_t max_server_num;
+	std::vector<DeparseServer *> servers; /* least recently used first */
+	DeparseServerPool(size_t max_server_num_);
+	~DeparseServerPool(void);
+	DeparseServer *get(const std::vector<std::string> &argv);
+	bool deparse(const DeparseCommand *cmd, const char *src, std::string *code);
+};
+
+#endif
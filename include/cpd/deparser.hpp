@@ -0,0 +1,35 @@
+#ifndef CPD_DEPARSER_HPP
+#define CPD_DEPARSER_HPP
+#include <string>
+#include <vector>
+
+/* one of the commands made by Compiler::Tools::CopyPasteDetector::__make_command */
+class DeparseCommand {
+public:
+	const char *process; /* perl ... -MO=Deparse (run with -e '<statement>') */
+	std::vector<std::string> argv; /* of the process, which reads the statement from stdin */
+	std::string stdin_header; /* written before the statement to make it look like -e */
+	std::vector<std::string> server_argv; /* perl ... running DeparseServer, or empty */
+	std::vector<std::string> zygote_argv; /* perl ... running Zygote, or empty */
+	std::vector<std::string> args; /* -I and -M switches of the command */
+	std::string stamp; /* the version of perl and the preloaded modules, which the codes depend on */
+	DeparseCommand(const char *process_) : process(process_) {}
+};
+
+/*
+ * Deparses statements without launching 'perl -MO=Deparse'.
+ * deparse() returns false if the statement must be deparsed by the process instead.
+ * Instances are owned by one worker thread.
+ */
+class Deparser {
+public:
+	virtual ~Deparser(void) {}
+	virtual bool deparse(const DeparseCommand *cmd, const char *src, std::string *code) = 0;
+	/*
+	 * sets a structural hash of the statement instead of its code, or an empty
+	 * one if the statement has nothing to compare. returns false if it must be deparsed.
+	 */
+	virtual bool fingerprint(const DeparseCommand *, const char *, std::string *) { return false; }
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef CPD_FILE_DEPARSER_HPP
+#define CPD_FILE_DEPARSER_HPP
+#include <cpd/stmt.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+/* a statement printed after a '#line' marker by 'perl -MO=Deparse,-l' */
+class DeparsedSegment {
+public:
+	int line;
+	size_t depth;
+	std::vector<std::string> branches; /* if/elsif/else chains are split at elsif and else */
+	DeparsedSegment(int line_, size_t depth_) : line(line_), depth(depth_) {}
+};
+
+/*
+ * Deparses a whole file at once and maps the code between '#line' markers
+ * onto the statements of the lexer by their start_line and indent.
+ * Statements which can't be mapped are left to the per-statement deparse.
+ */
+class FileDeparser {
+public:
+	std::vector<DeparsedSegment> segments;
+	bool deparse(const std::vector<std::string> &argv, const char *filename);
+	void parse(const std::string &output);
+	/* sets the code (with the trailing newline) of each mapped statement */
+	void assign(const Task *task, std::map<size_t, std::string> *codes);
+};
+
+#endif
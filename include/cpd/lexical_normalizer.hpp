@@ -0,0 +1,36 @@
+#ifndef CPD_LEXICAL_NORMALIZER_HPP
+#define CPD_LEXICAL_NORMALIZER_HPP
+#include <cpd/stmt.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+/* classes of Compiler::Lexer::TokenType given by Compiler::Tools::CopyPasteDetector::__token_classes */
+typedef enum {
+	TokenOther,
+	TokenComment, /* dropped */
+	TokenString,  /* quotes are unified to "" */
+	TokenKey,     /* a bareword hash key is quoted like a string */
+	TokenNumber,
+	TokenQuote,   /* q and qq, whose content is unified to a string */
+	TokenDelim    /* delimiters of quote-like operators are unified to / */
+} TokenClass;
+
+/*
+ * Canonicalizes statements from the tokens of Compiler::Lexer instead of
+ * deparsing them. It is faster than B::Deparse, but the statements which
+ * differ only in their syntax (e.g. 'if' and postfix 'if') aren't the same.
+ */
+class LexicalNormalizer {
+public:
+	std::map<int, TokenClass> classes; /* token type => class */
+	bool abstracts_literals; /* strings and numbers are replaced by placeholders */
+	LexicalNormalizer(bool abstracts_literals_);
+	/* returns an empty code if the statement has no tokens to compare */
+	std::string normalize(const Task *task, const Stmt *stmt) const;
+	/* returns the index of the first token of the statement in task->tokens, or std::string::npos */
+	size_t find_tokens(const Task *task, const Stmt *stmt) const;
+	TokenClass class_of(const SourceToken &token) const;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef CPD_LEXICAL_PREFILTER_HPP
+#define CPD_LEXICAL_PREFILTER_HPP
+#include <cpd/lexical_normalizer.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Finds the statements which can't be a clone before they are deparsed.
+ * A statement is put in a bucket by the sorted words of its tokens, which
+ * B::Deparse keeps as they are (quotes, parentheses, operators and numbers
+ * are left out). A statement alone in its bucket is never deparsed, as
+ * all the windows containing it are unique too.
+ */
+class LexicalPrefilter {
+public:
+	const LexicalNormalizer *normalizer; /* finds the tokens and the comments */
+	std::map<std::string, size_t> bucket_sizes;
+	LexicalPrefilter(const LexicalNormalizer *normalizer_);
+	/* adds the statements of the tasks to the buckets. the tasks may be given in several calls */
+	void count(const std::vector<Task *> &tasks);
+	/* sets Stmt::is_unique by the counted buckets and returns the number of the unique statements */
+	size_t mark_unique_stmts(const std::vector<Task *> &tasks) const;
+private:
+	std::string bucket(const Task *task, const Stmt *stmt) const;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef CPD_OP_FINGERPRINT_HPP
+#define CPD_OP_FINGERPRINT_HPP
+#include <map>
+#include <string>
+
+struct cv;
+struct op;
+
+/*
+ * Hashes the op tree of a statement compiled by an embedded interpreter.
+ * Op types, flags, constants, patterns and names are serialized in C++,
+ * so the statement is compared without generating its code by B::Deparse.
+ * Must be used in the context of the interpreter which owns the tree.
+ */
+class OpFingerprint {
+public:
+	bool abstracts_variables; /* lexicals are numbered by their first use instead of named */
+	std::string text;
+	size_t op_num; /* except nextstate, return, null and stub */
+	std::map<const void *, size_t> variables;
+	OpFingerprint(bool abstracts_variables_);
+	/* returns false if the statement has no ops, as B::Deparse prints nothing for it */
+	bool make(struct cv *cv, std::string *hash);
+private:
+	void walk(const struct op *o, struct cv *cv, size_t depth);
+	void append(const char *data, size_t size);
+};
+
+#endif
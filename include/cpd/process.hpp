@@ -0,0 +1,42 @@
+#ifndef CPD_PROCESS_HPP
+#define CPD_PROCESS_HPP
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/*
+ * A child started by posix_spawn without a shell. Its stdin and stdout
+ * are non-blocking pipes and its stderr goes to /dev/null.
+ */
+class Process {
+public:
+	pid_t pid;
+	int in;  /* -1 after the whole input is written */
+	int out; /* -1 after EOF */
+	std::string input;
+	size_t written;
+	std::string output;
+	Process(void);
+	~Process(void);
+	bool spawn(const std::vector<std::string> &argv, const std::string &input_);
+	/* both return false when the pipe is done and has been closed */
+	bool write_input(void);
+	bool read_output(void);
+	/* reaps the child. returns true if it exited with 0 */
+	bool wait(void);
+};
+
+/*
+ * Starts argv by posix_spawn without a shell, so its arguments are passed as
+ * they are. fds[i] becomes the descriptor i of the child, or /dev/null if it
+ * is -1. Returns the pid, or -1.
+ */
+pid_t spawn_process(const std::vector<std::string> &argv, const std::vector<int> &fds);
+
+/*
+ * Runs argv. input is written to its stdin while its stdout is read into output.
+ * Returns false if the process couldn't run or didn't exit with 0.
+ */
+bool run_process(const std::vector<std::string> &argv, const std::string &input, std::string *output);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CPD_PROCESS_MULTIPLEXER_HPP
+#define CPD_PROCESS_MULTIPLEXER_HPP
+#include <cpd/process.hpp>
+#include <string>
+#include <vector>
+
+/* a process to run by ProcessMultiplexer */
+class ProcessRequest {
+public:
+	std::vector<std::string> argv;
+	std::string input;
+	std::string output;
+	bool succeeded;
+	ProcessRequest(const std::vector<std::string> &argv_, const std::string &input_) :
+		argv(argv_), input(input_), succeeded(false) {}
+};
+
+/*
+ * Keeps up to process_num processes in flight from one thread.
+ * Their pipes are multiplexed by epoll, and the next request is spawned
+ * as soon as a process exits. SIGPIPE must be blocked by the caller.
+ *
+ * If max_process_num is larger than process_num, process_num climbs
+ * between 1 and max_process_num: it keeps moving in the same direction
+ * while the processes finished per second don't drop, and turns back when
+ * they do. It is also lowered while the runnable tasks of the others leave
+ * fewer CPUs than the processes in flight.
+ */
+class ProcessMultiplexer {
+public:
+	size_t process_num;
+	size_t max_process_num;
+	size_t cpu_num;
+	ProcessMultiplexer(size_t process_num_, size_t max_process_num_ = 0);
+	void run(const std::vector<ProcessRequest *> &requests);
+private:
+	int direction; /* +1 or -1 */
+	double last_throughput;
+	double window_start;
+	size_t window_finished_num;
+	void adapt(size_t running_num);
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef CPD_REPEAT_FINDER_HPP
+#define CPD_REPEAT_FINDER_HPP
+#include <stddef.h>
+#include <vector>
+
+/* a run of symbols which occurs more than once, at its positions in the sequence */
+class Repeat {
+public:
+	size_t length;
+	std::vector<size_t> positions; /* in the order of the suffixes */
+	Repeat(size_t length_) : length(length_) {}
+};
+
+/*
+ * Finds the maximal repeats of a sequence of symbols (dense ids >= 0) by its
+ * suffix array and the LCP array: the runs which occur twice at least, and which
+ * can't be extended to the left or to the right without losing an occurrence.
+ * A separator ends a run, as every separator is a symbol of its own, so runs
+ * never cross the sequences added one after another.
+ */
+class RepeatFinder {
+public:
+	RepeatFinder(void) : separator_num(0) {}
+	void add(int symbol) { symbols.push_back(symbol); }
+	void separate(void) { symbols.push_back(-(int)++separator_num); }
+	size_t size(void) const { return symbols.size(); }
+	bool is_separator(size_t position) const { return symbols.at(position) < 0; }
+	void find(std::vector<Repeat> *repeats) const;
+private:
+	std::vector<int> symbols; /* separators are negative */
+	size_t separator_num;
+	void make_suffix_array(std::vector<size_t> *suffixes) const;
+	void make_lcp_array(const std::vector<size_t> &suffixes, std::vector<size_t> *lcps) const;
+};
+
+#endif
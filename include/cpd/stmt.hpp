@@ -0,0 +1,120 @@
+#ifndef CPD_STMT_HPP
+#define CPD_STMT_HPP
+#include <cpd/arena.hpp>
+#include <cpd/deparser.hpp>
+#include <map>
+#include <new>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/* a statement given by Compiler::Lexer::get_groups_by_syntax_level, allocated by the arena of its task */
+class Stmt {
+public:
+	const char *src;
+	const char *filename;
+	const DeparseCommand *full_cmd;
+	const DeparseCommand *normal_cmd;
+	int token_num;
+	int indent;
+	int block_id;
+	int start_line;
+	int end_line;
+	int has_warnings;
+	bool is_unique; /* no other statement is lexically alike, so it is never deparsed */
+	Stmt(const char *src_, int token_num_, int indent_, int block_id_,
+		 int start_line_, int end_line_, int has_warnings_) :
+		src(src_), filename(NULL), full_cmd(NULL), normal_cmd(NULL), token_num(token_num_), indent(indent_), block_id(block_id_),
+		start_line(start_line_), end_line(end_line_), has_warnings(has_warnings_), is_unique(false) {}
+};
+
+#define STMT_HASH_SIZE 16
+
+/* the 128-bit md5 digest of a statement or of a window of statements */
+class StmtHash {
+public:
+	unsigned char bytes[STMT_HASH_SIZE];
+	StmtHash(void) { memset(bytes, 0, sizeof(bytes)); }
+};
+
+/* a hash in the parents of a DeparsedStmt, which points to the hash of the parent itself */
+class ParentHash {
+public:
+	const StmtHash *hash;
+	ParentHash *next;
+	ParentHash(const StmtHash *hash_) : hash(hash_), next(NULL) {}
+};
+
+/*
+ * allocated by the arena of the worker which has added it, with its parents.
+ * the code is the range [text_offset, text_offset + text_size) of the text of its detection,
+ * where the statements of a block follow each other, so a window is the range of its statements.
+ */
+class DeparsedStmt {
+public:
+	StmtHash hash;
+	size_t file_id; /* the index of the task in the detection */
+	size_t text_offset;
+	size_t text_size;
+	bool is_source; /* the code is the source of the lexer, which is deparsed by the report */
+	bool has_warnings; /* one of its statements is deparsed by the full command */
+	int lines;
+	int start_line;
+	int end_line;
+	int indent;
+	int block_id;
+	int stmt_num;
+	int token_num;
+	uint32_t stmt_id; /* of the hash of a statement interned by its detection (see StmtDictionary) */
+	ParentHash *parents; /* in the order they are added */
+	ParentHash *last_parent;
+	DeparsedStmt(const StmtHash &hash_, size_t text_offset_, size_t text_size_, bool is_source_,
+				 int lines_,     int start_line_, int end_line_,
+				 int indent_,    int block_id_,   int stmt_num_,
+				 int token_num_) :
+		hash(hash_), file_id(0), text_offset(text_offset_), text_size(text_size_),
+		is_source(is_source_), has_warnings(false),
+		lines(lines_), start_line(start_line_), end_line(end_line_),
+		indent(indent_), block_id(block_id_), stmt_num(stmt_num_),
+		token_num(token_num_), stmt_id(0), parents(NULL), last_parent(NULL) {}
+	void add_parent(Arena *arena, const StmtHash *hash) {
+		ParentHash *parent = new (arena->allocate(sizeof(ParentHash))) ParentHash(hash);
+		if (last_parent) {
+			last_parent->next = parent;
+		} else {
+			parents = parent;
+		}
+		last_parent = parent;
+	}
+};
+
+/* a token given by Compiler::Lexer::tokenize */
+class SourceToken {
+public:
+	int type;
+	int line;
+	std::string data;
+	SourceToken(int type_, int line_, const std::string &data_) :
+		type(type_), line(line_), data(data_) {}
+};
+
+/* the statements of one file. a task given by its filename only is prepared by the workers */
+class Task {
+public:
+	const char *filename;
+	bool is_prepared; /* lexed into the statements, the tokens and the used modules */
+	std::vector<std::string> file_argv; /* perl ... -MO=Deparse,-l (run with the filename) */
+	std::vector<Stmt *> stmts;
+	std::vector<SourceToken> tokens; /* of the whole file, only for the lexical normalization and the prefilter */
+	std::map<int, size_t> token_lines; /* line => index of its first token */
+	std::vector<std::string> modules; /* used by the file, "name" or "name args" */
+	std::vector<DeparseCommand *> commands; /* full and normal of the statements */
+	Arena arena; /* of the statements, and of their strings if perl doesn't keep them */
+	Task(void) : filename(NULL), is_prepared(true) {}
+	~Task(void) {
+		for (size_t i = 0; i < commands.size(); i++) delete commands.at(i);
+	}
+};
+
+#endif
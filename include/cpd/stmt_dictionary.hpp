@@ -0,0 +1,53 @@
+#ifndef CPD_STMT_DICTIONARY_HPP
+#define CPD_STMT_DICTIONARY_HPP
+#include <cpd/stmt.hpp>
+#include <pthread.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#define STMT_DICTIONARY_SHARD_NUM 64 /* power of 2 */
+
+/* orders the hashes of the statements to intern them */
+class StmtHashOrder {
+public:
+	bool operator()(const StmtHash &a, const StmtHash &b) const {
+		return memcmp(a.bytes, b.bytes, STMT_HASH_SIZE) < 0;
+	}
+};
+
+/* an interned hash */
+class StmtEntry {
+public:
+	uint32_t id;
+	uint32_t count; /* of the occurrences added so far */
+	StmtEntry(void) : id(0), count(0) {}
+};
+
+/*
+ * Interns the hashes of the statements of a detection to dense ids, counting
+ * their occurrences, while the workers add their statements. A hash belongs
+ * to the shard chosen by its first byte (the hashes are md5 digests), so the
+ * workers seldom wait for each other, and only a hash seen for the first time
+ * takes the lock of the ids.
+ */
+class StmtDictionary {
+public:
+	StmtDictionary(void);
+	~StmtDictionary(void);
+	/* returns the id of hash, which is given the next id if it is new */
+	uint32_t add(const StmtHash &hash);
+	/* counts indexed by the id, once the workers have finished */
+	void get_counts(std::vector<uint32_t> *counts) const;
+private:
+	class Shard {
+	public:
+		pthread_mutex_t mutex;
+		std::map<StmtHash, StmtEntry, StmtHashOrder> entries;
+	};
+	Shard shards[STMT_DICTIONARY_SHARD_NUM];
+	pthread_mutex_t id_mutex;
+	uint32_t next_id;
+};
+
+#endif
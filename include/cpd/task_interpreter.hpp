@@ -0,0 +1,29 @@
+#ifndef CPD_TASK_INTERPRETER_HPP
+#define CPD_TASK_INTERPRETER_HPP
+#include <cpd/stmt.hpp>
+#include <string>
+#include <vector>
+
+struct interpreter;
+struct hv;
+
+/* copies the task made by Compiler::Tools::CopyPasteDetector::TaskPreparer out of perl */
+typedef void (*TaskDecoder)(struct interpreter *perl, struct hv *prepared_task, Task *task);
+
+/*
+ * A perl interpreter embedded in a worker thread which reads, lexes and groups
+ * the files of the tasks by Compiler::Lexer, so the files are prepared by the
+ * workers in parallel instead of the perl which calls the engine.
+ */
+class TaskInterpreter {
+public:
+	struct interpreter *perl;
+	bool is_alive;
+	/* args are the -I switches, options are given to TaskPreparer::setup */
+	TaskInterpreter(const std::vector<std::string> &args, const std::vector<std::string> &options);
+	~TaskInterpreter(void);
+	/* the commands are made by the caller from the used modules. returns false with the error of perl */
+	bool prepare(Task *task, TaskDecoder decode, std::string *error);
+};
+
+#endif
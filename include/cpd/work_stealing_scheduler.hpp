@@ -0,0 +1,42 @@
+#ifndef CPD_WORK_STEALING_SCHEDULER_HPP
+#define CPD_WORK_STEALING_SCHEDULER_HPP
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+#define WHOLE_TASK ((size_t)-1)
+
+/* a statement of a task, or the whole task */
+class WorkItem {
+public:
+	size_t task_id;
+	size_t stmt_id; /* WHOLE_TASK for the task itself */
+	size_t cost;    /* the number of the tokens or the statements */
+	WorkItem(void) : task_id(0), stmt_id(WHOLE_TASK), cost(0) {}
+	WorkItem(size_t task_id_, size_t stmt_id_, size_t cost_) :
+		task_id(task_id_), stmt_id(stmt_id_), cost(cost_) {}
+};
+
+/*
+ * Tasks are dealt largest first to the worker with the least cost, and the
+ * items of a task stay together in its deque, so a worker keeps using the
+ * deparser of the same command. A worker takes the front of its own deque,
+ * and an idle worker steals the back of the deque which has the most cost
+ * left, so one large file never keeps a single worker busy while the others
+ * are idle. No item is added while the workers run.
+ */
+class WorkStealingScheduler {
+public:
+	WorkStealingScheduler(size_t worker_num, std::vector<WorkItem> items);
+	~WorkStealingScheduler(void);
+	/* returns false if no item is left for any worker */
+	bool next(size_t worker_id, WorkItem *item);
+private:
+	size_t worker_num;
+	std::vector<std::deque<WorkItem> > queues;
+	std::vector<size_t> costs; /* the cost left in each deque */
+	pthread_mutex_t *mutexes;
+	bool pop(size_t queue_id, bool steals, WorkItem *item);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef CPD_WORKER_POOL_HPP
+#define CPD_WORKER_POOL_HPP
+#include <pthread.h>
+#include <vector>
+
+/* the work given to every worker of WorkerPool at once */
+class WorkerRound {
+public:
+	virtual ~WorkerRound(void) {}
+	virtual void run(size_t worker_id) = 0;
+};
+
+/*
+ * Threads started once and kept waiting between the rounds, so the state a
+ * worker keeps by its worker_id (e.g. embedded interpreters) stays warm
+ * across the rounds and the detections.
+ */
+class WorkerPool {
+public:
+	size_t worker_num;
+	/* no threads are started for 0 worker, and the caller runs the rounds by itself */
+	WorkerPool(size_t worker_num_);
+	/* waits for the round in progress and joins the threads */
+	~WorkerPool(void);
+	/* returns after all the workers have finished the round */
+	void run(WorkerRound *round);
+private:
+	std::vector<pthread_t> threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t round_started;
+	pthread_cond_t round_finished;
+	WorkerRound *round;
+	size_t round_id; /* incremented by each round */
+	size_t finished_num;
+	bool is_stopped;
+	static void *work(void *worker);
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef CPD_ZYGOTE_HPP
+#define CPD_ZYGOTE_HPP
+#include <cpd/deparse_server.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * A perl process running Compiler::Tools::CopyPasteDetector::Zygote.
+ * It loads the modules of its command once and forks a DeparseServer for
+ * each connection, so the children start with the modules already loaded.
+ * The socket lives in a directory only we can enter, and the zygote serves
+ * the connections of our user only, as a child compiles what it is sent.
+ */
+class Zygote {
+public:
+	std::vector<std::string> argv;
+	std::string dir;     /* made by mkdtemp (mode 0700) for the socket */
+	std::string address; /* path of the unix socket in dir */
+	pid_t pid;
+	int control; /* the zygote exits by EOF of this pipe */
+	bool is_alive;
+	/* the zygote keeps max_child_num children at most, and queues the other connections */
+	Zygote(const std::vector<std::string> &argv_, size_t max_child_num);
+	~Zygote(void);
+	/* returns a socket to a forked DeparseServer, or -1 */
+	int connect(void) const;
+};
+
+/* zygotes shared by all worker threads, keyed by the argv of the zygote command */
+class ZygoteRegistry {
+public:
+	pthread_mutex_t mutex;
+	std::map<std::vector<std::string>, Zygote *> zygotes;
+	size_t max_child_num; /* of each zygote, as many as the worker threads keep */
+	ZygoteRegistry(size_t max_child_num_);
+	~ZygoteRegistry(void);
+	const Zygote *get(const std::vector<std::string> &argv);
+};
+
+class ZygoteChild {
+public:
+	std::vector<std::string> argv;
+	DeparseServer *server;
+	size_t deparsed_num;
+	ZygoteChild(const std::vector<std::string> &argv_, DeparseServer *server_) :
+		argv(argv_), server(server_), deparsed_num(0) {}
+};
+
+/* children forked for one worker thread. a child deparses batch_size statements at most */
+class ZygoteDeparser : public Deparser {
+public:
+	ZygoteRegistry *registry;
+	size_t batch_size;
+	size_t max_child_num;
+	std::vector<ZygoteChild> children; /* least recently used first */
+	ZygoteDeparser(ZygoteRegistry *registry_, size_t batch_size_, size_t max_child_num_);
+	~ZygoteDeparser(void);
+	bool deparse(const DeparseCommand *cmd, const char *src, std::string *code);
+private:
+	DeparseServer *get(const std::vector<std::string> &argv);
+};
+
+#endif
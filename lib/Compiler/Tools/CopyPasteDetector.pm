@@ -24,6 +24,8 @@ use HTML::Template;
 use File::Copy::Recursive qw(rcopy);
 use File::Basename qw/dirname basename/;
 use File::Path;
+use File::Spec;
+use IPC::Open3;
 use JSON::XS;
 use Data::Dumper;
 use Module::CoreList;
@@ -32,7 +34,7 @@ use Compiler::Tools::CopyPasteDetector::CloneSetMetrics;
 use Compiler::Tools::CopyPasteDetector::FileMetrics;
 use Compiler::Tools::CopyPasteDetector::DirectoryMetrics;
 use Compiler::Tools::CopyPasteDetector::Scattergram;
-use constant DEBUG => 1;
+use Compiler::Tools::CopyPasteDetector::TaskPreparer;
 use List::MoreUtils qw(any);
 
 ### ================== Constants ======================== ###
@@ -43,6 +45,45 @@ my $MAX_ROW_NUM_PER_PAGE = 100;
 my $DEFAULT_MIN_LINE_NUM = 4;
 my $DEFAULT_MIN_TOKEN_NUM = 30;
 my $DEFAULT_ORDER_NAME = 'length';
+my $DEFAULT_DEPARSER_NAME = 'process';
+my $DEFAULT_DEPARSE_UNIT_NAME = 'stmt';
+my $DEFAULT_SCHEDULER_NAME = 'thread';
+my $DEFAULT_MATCHER_NAME = 'window';
+# the files prepared and deparsed at once, while the previous ones are grouped
+my $STREAM_WINDOW_FILE_NUM = 32;
+my @FILE_DEPARSE_ARGS = ('-MCompiler::Tools::CopyPasteDetector::FileDeparseHooker', '-MO=Deparse,-l');
+# the statement given on stdin is deparsed as if it were given by -e:
+# B::Deparse prints the pragmata of $0 only, and -e has no __DATA__ text.
+my $STDIN_SOURCE_HEADER = <<'HEADER' . qq{#line 1 "-e"\n};
+BEGIN {
+    $0 = '-e';
+    CHECK {
+        my @stashes = (\%main::);
+        while (my $stash = shift @stashes) {
+            foreach my $name (keys %$stash) {
+                my $gv = \$stash->{$name};
+                next if ref $gv ne 'GLOB';
+                if ($name eq 'DATA') {
+                    () = readline *$$gv{IO} if *$$gv{IO};
+                } elsif ($name =~ /::$/ && $name ne 'main::') {
+                    push @stashes, *$$gv{HASH};
+                }
+            }
+        }
+    }
+}
+HEADER
+my %LEXICAL_TOKEN_CLASSES = (
+    comment => [qw(T_Comment T_Pod)],
+    string  => [qw(T_String T_RawString T_HereDocument T_RawHereDocument)],
+    key     => [qw(T_Key)],
+    number  => [qw(T_Int T_Double)],
+    quote   => [qw(T_RegQuote T_RegDoubleQuote)],
+    delim   => [qw(T_RegDelim)]
+);
+# the servers and the zygotes are spawned by their argv, without a shell
+my @DEPARSE_SERVER_ARGS = ('-MCompiler::Tools::CopyPasteDetector::DeparseServer', '-e', 'Compiler::Tools::CopyPasteDetector::DeparseServer::run(sub { eval $_[0] })');
+my @ZYGOTE_ARGS = ('-MCompiler::Tools::CopyPasteDetector::Zygote', '-e', 'Compiler::Tools::CopyPasteDetector::Zygote::run(sub { eval $_[0] })');
 
 ### ================ Public Methods ===================== ###
 
@@ -54,24 +95,87 @@ sub new {
     my $order   = $options->{order_by};
     my $jobs    = $options->{jobs};
     my $ignore  = $options->{ignore_variable_name};
+    my $ignore_literal = $options->{ignore_literal};
+    my $prefilter = $options->{prefilter};
     my $encoding = $options->{encoding};
+    my $deparser = $options->{deparser};
+    my $deparse_unit = $options->{deparse_unit};
+    my $scheduler = $options->{scheduler};
+    my $matcher = $options->{matcher};
+    my $cache_dir = $options->{cache_dir};
+    my $cache_size = $options->{cache_size};
     my $output_dirname = $options->{output_dirname} || 'copy_paste_detector_output';
     my @order_by_list = qw(length population kind_of_token radius nif);
+    # 'auto' sizes the workers by the CPUs the cgroup allows, and lets the event scheduler adapt the processes in flight
+    my $auto_jobs = (defined $jobs && $jobs eq 'auto') ? 1 : 0;
+    $jobs = get_available_cpu_num() if ($auto_jobs);
     my $checked_order = $order if (defined $order && grep {$_ eq $order} @order_by_list);
+    my @deparser_list = qw(process server embedded zygote fingerprint lexical);
+    my $checked_deparser = $deparser if (defined $deparser && grep {$_ eq $deparser} @deparser_list);
+    my @deparse_unit_list = qw(stmt file);
+    my $checked_deparse_unit = $deparse_unit if (defined $deparse_unit && grep {$_ eq $deparse_unit} @deparse_unit_list);
+    my @scheduler_list = qw(thread event);
+    my $checked_scheduler = $scheduler if (defined $scheduler && grep {$_ eq $scheduler} @scheduler_list);
+    my @matcher_list = qw(window suffix_array block);
+    my $checked_matcher = $matcher if (defined $matcher && grep {$_ eq $matcher} @matcher_list);
     my $self = {
-        tmp => q{__copy_paste_detector.tmp},
-        stmt_num_manager     => +{},
         min_token_num        => $tk_n || $DEFAULT_MIN_TOKEN_NUM,
         min_line_num         => $line_n || $DEFAULT_MIN_LINE_NUM,
         jobs                 => $jobs || 1,
+        auto_jobs            => $auto_jobs,
         ignore_variable_name => $ignore || 0,
+        ignore_literal       => $ignore_literal || 0,
+        prefilter            => (defined $prefilter) ? $prefilter : 0,
         order_by             => $checked_order || $DEFAULT_ORDER_NAME,
+        deparser             => $checked_deparser || $DEFAULT_DEPARSER_NAME,
+        deparse_unit         => $checked_deparse_unit || $DEFAULT_DEPARSE_UNIT_NAME,
+        scheduler            => $checked_scheduler || $DEFAULT_SCHEDULER_NAME,
+        matcher              => $checked_matcher || $DEFAULT_MATCHER_NAME,
+        cache_dir            => $cache_dir,
+        cache_size           => $cache_size,
         encoding             => $encoding,
-        output_dirname       => $output_dirname
+        output_dirname       => $output_dirname,
+        engine               => $options->{engine}
     };
     return bless($self, $class);
 }
 
+# the engine keeps its worker threads and their deparsers warm, so it can be given to the next detector
+sub engine {
+    my ($self) = @_;
+    return $self->__engine();
+}
+
+# returns the code of a record in base64. statements compared by their op trees
+# (deparser 'fingerprint') have the source instead of the deparsed code, which is
+# deparsed here by the commands of their file, with its -I and the modules it uses,
+# like the other deparsers. get_score does it for the first clone of a reported set
+sub materialize_src {
+    my ($self, $stmt) = @_;
+    return $stmt->{src} if (defined $stmt->{src});
+    my $orig = substr(${$stmt->{text}}, $stmt->{text_offset}, $stmt->{text_size});
+    my $code = $orig;
+    if ($stmt->{is_source}) {
+        my $argvs = (ref $stmt->{deparse_argvs}) ? $stmt->{deparse_argvs} : [ [ $^X, '-MO=Deparse' ] ];
+        foreach my $argv (@$argvs) {
+            ($code) = $self->__run_process($argv, "$STDIN_SOURCE_HEADER$orig\n");
+            chomp($code);
+            last unless ($code eq '' || $code eq $DEPARSE_ERROR_MESSAGE);
+        }
+        $code = $orig if ($code eq '' || $code eq $DEPARSE_ERROR_MESSAGE);
+    }
+    $stmt->{orig} = $orig;
+    $stmt->{src} = encode_base64($code, '');
+    return $stmt->{src};
+}
+
+# returns the code of a record in base64 as it is kept, without deparsing the source
+sub src_of {
+    my ($self, $stmt) = @_;
+    return $stmt->{src} if (defined $stmt->{src});
+    return encode_base64(substr(${$stmt->{text}}, $stmt->{text_offset}, $stmt->{text_size}), '');
+}
+
 sub get_target_files_by_project_root {
     my ($self, $root) = @_;
     my @cur_files = glob("$root/*");
@@ -89,8 +193,7 @@ sub get_target_files_by_project_root {
 
 sub detect {
     my ($self, $files) = @_;
-    return $self->__parallel_detect($files) if ($self->{jobs} > 1);
-    return $self->__detect($files);
+    return $self->__parallel_detect($files);
 }
 
 sub get_score {
@@ -98,26 +201,35 @@ sub get_score {
     my $min_token_num = $self->{min_token_num};
     my $min_line_num  = $self->{min_line_num};
     my $order_by      = $self->{order_by};
-    my @deparsed_stmts = @$stmts;
-    my $clone_set_map = +{};
     my $filemap = +{};
     my @clone_set_results;
-    foreach my $stmt (@deparsed_stmts) {
-        push(@{$clone_set_map->{$stmt->{hash}}}, $stmt);
+    # the statements streamed by detect are grouped already, unless they were changed since
+    my $is_grouped = (defined $self->{grouped_stmts} && $self->{grouped_stmts} == $stmts &&
+                      $self->{grouped_stmt_num} == @$stmts);
+    my $clone_set_map = ($is_grouped) ? $self->{clone_set_map} : +{};
+    # the detector doesn't keep the statements of a detection once they are scored
+    delete @$self{qw(grouped_stmts grouped_stmt_num clone_set_map)};
+    unless ($is_grouped) {
+        foreach my $stmt (@$stmts) {
+            push(@{$clone_set_map->{$stmt->{hash}}}, $stmt);
+        }
     }
     foreach my $clone_set (values %$clone_set_map) {
         my @clones = @$clone_set;
         my $hit = scalar @$clone_set;
         next if ($hit < 2 || $self->__exists_parents($clone_set));
         my $first_clone = $clone_set->[0];
-        next unless ($first_clone->{lines} + 1 >= $min_line_num && $first_clone->{token_num} > $min_token_num);
+        # the suffix_array matcher keeps the repeats by the same sizes
+        next unless (is_reported_size($first_clone->{lines}, $first_clone->{token_num}, $min_line_num, $min_token_num));
+        $self->materialize_src($first_clone);
         $self->__set_neighbor_name($clone_set);
         my $token_num = $first_clone->{token_num};
         my $clone_metrics = Compiler::Tools::CopyPasteDetector::CloneSetMetrics->new($clone_set)->get_score();
         push(@clone_set_results, { metrics => $clone_metrics, set => $clone_set });
         foreach my $clone (@$clone_set) {
             my $filename = $clone->{file};
-            my $hash = $clone->{hash};
+            # the reports name the clones by the hashes in hex
+            my $hash = unpack('H*', $clone->{hash});
             $filemap->{$filename} = +{ clone => +{} } unless (exists $filemap->{$filename});
             my $file_point = $filemap->{$filename};
             unless (exists $file_point->{all_token_num}) {
@@ -128,7 +240,7 @@ sub get_score {
             my $clone_point = $file_point->{clone}->{$hash};
             $clone_point->{count}++;
             $clone_point->{token_num} = $token_num;
-            $clone_point->{parents} = $clone->{parents};
+            $clone_point->{parents} = [ map { unpack('H*', $_) } @{$clone->{parents}} ];
             push(@{$clone_point->{start_line}}, $clone->{start_line});
             push(@{$clone_point->{end_line}}, $clone->{end_line});
             $clone_point->{from_names} = $clone->{from_names};
@@ -227,6 +339,7 @@ sub gen_html {
             my $result = $set->[$i];
             if ($i == 0) {
                 $result->{src} = decode_base64($result->{src});
+                $result->{hash} = unpack('H*', $result->{hash});
             } else {
                 delete $result->{src};
                 delete $result->{hash};
@@ -239,6 +352,11 @@ sub gen_html {
             delete $result->{block_id};
             delete $result->{stmt_num};
             delete $result->{orig};
+            delete $result->{text};
+            delete $result->{text_offset};
+            delete $result->{text_size};
+            delete $result->{is_source};
+            delete $result->{deparse_argvs};
         }
     }
     $json = JSON::XS->new();
@@ -368,43 +486,12 @@ sub __gen_file {
 
 sub __get_script {
     my ($self, $filename) = @_;
-    my $script = "";
-    open(FP, "<", $filename) or die("Error");
-    $script .= $_ foreach (<FP>);
-    close(FP);
-    return $script;
+    return Compiler::Tools::CopyPasteDetector::TaskPreparer::read_script($filename);
 }
 
 sub __ignore_orthographic_variation_of_variable_name {
     my ($self, $tokens) = @_;
-    my @variables = (
-        Compiler::Lexer::TokenType::T_Var,
-        Compiler::Lexer::TokenType::T_CodeVar,
-        Compiler::Lexer::TokenType::T_ArrayVar,
-        Compiler::Lexer::TokenType::T_HashVar,
-        Compiler::Lexer::TokenType::T_LocalVar,
-        Compiler::Lexer::TokenType::T_LocalArrayVar,
-        Compiler::Lexer::TokenType::T_LocalHashVar,
-        Compiler::Lexer::TokenType::T_GlobalVar,
-        Compiler::Lexer::TokenType::T_GlobalArrayVar,
-        Compiler::Lexer::TokenType::T_GlobalHashVar
-    );
-    foreach my $token (@$tokens) {
-        if (grep { $_ == $token->{type} } @variables) {
-            $token->{data} = substr($token->{data}, 0, 1) . "v";
-        }
-    }
-}
-
-sub __detect {
-    my ($self, $files) = @_;
-    print "normal_detecting\n";
-    my @stmts;
-    foreach my $file (@$files) {
-        my $stmt_data = $self->__get_stmt_data($file, $self->__get_script($file));
-        push(@stmts, @$stmt_data);
-    }
-    return \@stmts;
+    Compiler::Tools::CopyPasteDetector::TaskPreparer::ignore_orthographic_variation_of_variable_name($tokens);
 }
 
 sub __make_command {
@@ -424,7 +511,11 @@ sub __make_command {
     }
     push(@$modules, { name => 'Compiler::Tools::CopyPasteDetector::DeparseHooker', args => undef});
     my $perl = $^X;
-    my $include_dirs .= join(' ', map { "-I$_"; } @INC);
+    my @include_args = map { "-I$_"; } @INC;
+    my @preload_args = map {
+        ((defined $_->{args}) ? "-M$_->{name} $_->{args}" : "-M$_->{name}", '-M-strict');
+    } @$modules;
+    my $include_dirs .= join(' ', @include_args);
     my $preload_option = join(' ', map {
         if (defined $_->{args}) {
             my $args = $_->{args};
@@ -434,141 +525,184 @@ sub __make_command {
             sprintf("-M%s -M-strict", $_->{name});
         }
     } @$modules);
+    # the cache keeps the codes by the version of perl and the files of the preloaded modules
+    my $normal_stamp = "$]";
+    my $full_stamp = join("\0", $normal_stamp, map {
+        my $path = $_->{name}; $path =~ s|::|/|g; $path .= '.pm';
+        (exists $INC{$path} && defined $INC{$path}) ? "$INC{$path}:" . ((stat($INC{$path}))[9] || 0) : $_->{name};
+    } @$modules);
     return {
-        normal => "$perl -MO=Deparse",
-        full   => "$perl $include_dirs $preload_option -MO=Deparse"
+        normal        => "$perl -MO=Deparse",
+        full          => "$perl $include_dirs $preload_option -MO=Deparse",
+        normal_server_argv => [ $perl, @include_args, @DEPARSE_SERVER_ARGS ],
+        full_server_argv   => [ $perl, @include_args, @preload_args, @DEPARSE_SERVER_ARGS ],
+        normal_zygote_argv => [ $perl, @include_args, @ZYGOTE_ARGS ],
+        full_zygote_argv   => [ $perl, @include_args, @preload_args, @ZYGOTE_ARGS ],
+        normal_argv   => [ $perl, '-MO=Deparse' ],
+        full_argv     => [ $perl, @include_args, @preload_args, '-MO=Deparse' ],
+        file_argv     => [ $perl, @include_args, @FILE_DEPARSE_ARGS ],
+        stdin_header  => $STDIN_SOURCE_HEADER,
+        normal_args   => \@include_args,
+        full_args     => [ @include_args, @preload_args ],
+        normal_stamp  => $normal_stamp,
+        full_stamp    => $full_stamp
     };
 }
 
 sub __parallel_detect {
     my ($self, $files) = @_;
-    print "parallel_detecting\n";
-    my @prepare;
-    foreach my $filename (@$files) {
-        my $script = $self->__get_script($filename);
-        my $lexer = Compiler::Lexer->new($filename);
-        my $tokens = $lexer->tokenize($script);
-        if ($self->{ignore_variable_name}) {
-            $self->__ignore_orthographic_variation_of_variable_name($tokens);
+    my $engine = $self->__engine;
+    # the repeats of the suffix array are found across all the files, so they are detected at once
+    my $window_file_num = ($self->{matcher} eq 'suffix_array') ? scalar @$files : $STREAM_WINDOW_FILE_NUM;
+    my @windows;
+    for (my $i = 0; $i < @$files; $i += $window_file_num) {
+        my $last = ($i + $window_file_num < @$files) ? $i + $window_file_num - 1 : $#$files;
+        push(@windows, [ @$files[$i .. $last] ]);
+    }
+    # a statement is unique among all the files, so their buckets are counted before the first window
+    my $counts_buckets = ($self->{prefilter} && $self->{deparser} ne 'lexical' && @windows > 1);
+    my @stmts;
+    my $clone_set_map = +{};
+    # the commands keep the modification times of the modules as they are at each detection
+    delete $self->{commands};
+    my $is_detected = eval {
+        if ($counts_buckets) {
+            $engine->count_buckets($_) foreach (@windows);
         }
-        my $stmts = $lexer->get_groups_by_syntax_level($tokens, Compiler::Lexer::SyntaxType::T_Stmt);
-        my $modules = $lexer->get_used_modules($script);
-        my $cmd = $self->__make_command($modules);
-        foreach my $stmt (@$stmts) {
-            $stmt->{src} =~ s/'/'\\''/g;
+        print "detecting...\n";
+        # the files are read and lexed by the workers of the engine, their commands are made
+        # here, and the window in flight is deparsed while the previous one is grouped
+        my $deparsed_stmts;
+        foreach my $window (@windows) {
+            my $modules = $engine->prepare($window);
+            $engine->submit($window, [ map { $self->__command_of($_) } @$modules ]);
+            $self->__group_stmts($deparsed_stmts, \@stmts, $clone_set_map) if ($deparsed_stmts);
+            $deparsed_stmts = $engine->collect();
         }
-        push(@prepare, {filename => $filename, stmts => $stmts, command => $cmd});
-    }
-    print "detecting...\n";
-    my $deparsed_stmts = get_deparsed_stmts_by_xs_parallel(\@prepare, $self->{jobs});
-    return $$deparsed_stmts;
+        $self->__group_stmts($deparsed_stmts, \@stmts, $clone_set_map) if ($deparsed_stmts);
+        1;
+    };
+    my $error = $@;
+    # the files prepared for a detection which has died are dropped with the buckets
+    $engine->clear_prepared();
+    die $error unless ($is_detected);
+    # get_score takes over the clone sets grouped while the windows were deparsed
+    $self->{grouped_stmts} = \@stmts;
+    $self->{grouped_stmt_num} = scalar @stmts;
+    $self->{clone_set_map} = $clone_set_map;
+    return \@stmts;
 }
 
-sub __get_stmt_data {
+# lexes the file (or its script if given) into the task of the engine, with the command of its used modules
+sub __prepare_task {
     my ($self, $filename, $script) = @_;
-    my $lexer = Compiler::Lexer->new($filename);
-    my $tokens = $lexer->tokenize($script);
-    if ($self->{ignore_variable_name}) {
-        $self->__ignore_orthographic_variation_of_variable_name($tokens);
-    }
-    my $stmts = $lexer->get_groups_by_syntax_level($tokens, Compiler::Lexer::SyntaxType::T_Stmt);
-    my $modules = $lexer->get_used_modules($script);
-    my $cmd = $self->__make_command($modules);
-    my @deparsed_stmts;
-    my $tmp_file = $self->{tmp};
-    my @stmts = @$stmts;
-    $self->{stmt_num_manager} = +{};
-    foreach my $stmt (@stmts) {
-        my $src = $stmt->{src};
-        my @splitted = split(/^\s+(else|elsif)/, $src);
-        $src = $splitted[-1] if (scalar @splitted > 1);
-        $src =~ s/'/'\\''/g;
-        my $cmd = ($stmt->{has_warnings}) ? $cmd->{full} : $cmd->{normal};
-        my $code = `$cmd -e '$src' 2> /dev/null`;
-        chomp($code);
-        $code = "$splitted[1] $code" if (scalar @splitted > 1);
-        if ($code eq "" || $code eq ";\n" || $code eq $DEPARSE_ERROR_MESSAGE) {
-            if (DEBUG) {
-                #print sprintf("%s : %s : %s\n", `$cmd`, $cmd, $filename);
-                print "orig : [ $stmt->{src} ]\n";
-            }
-            next;
-        }
-        $self->__add_stmt(\@deparsed_stmts, $stmt, $code, $filename);
+    my $task = $self->__lex_task($filename, $script);
+    $task->{command} = $self->__command_of(delete $task->{modules});
+    return $task;
+}
+
+# the workers of the engine lex the files by TaskPreparer too, without loading their modules
+sub __lex_task {
+    my ($self, $filename, $script) = @_;
+    return Compiler::Tools::CopyPasteDetector::TaskPreparer::lex_task($self, $filename, $script);
+}
+
+# the modules are loaded and checked once for all the files using them alike
+sub __command_of {
+    my ($self, $modules) = @_;
+    my $key = join("\0", @$modules);
+    $self->{commands}->{$key} = $self->__make_command([ map {
+        my ($name, $args) = split(/ /, $_, 2);
+        +{ name => $name, args => $args };
+    } @$modules ]) unless (exists $self->{commands}->{$key});
+    return $self->{commands}->{$key};
+}
+
+sub __group_stmts {
+    my ($self, $deparsed_stmts, $stmts, $clone_set_map) = @_;
+    foreach my $stmt (@$$deparsed_stmts) {
+        push(@$stmts, $stmt);
+        push(@{$clone_set_map->{$stmt->{hash}}}, $stmt);
     }
-    foreach my $stmt (@deparsed_stmts) {
-        my $start_line = $stmt->{start_line};
-        my $lines = $stmt->{lines};
-        my @parents = grep { $_->{start_line} == $start_line - ($_->{lines} - $lines) } @deparsed_stmts;
-        @parents = grep { $_->{lines} > $stmt->{lines} } @parents;
-        push(@{$stmt->{parents}}, $_->{hash}) foreach (@parents);
+}
+
+# the engine keeps the cache, the workers and the deparse children across the calls of detect
+sub __engine {
+    my ($self) = @_;
+    my $engine = $self->{engine};
+    my $options = $self->__engine_options();
+    # a new thread of perl gets an unblessed reference instead of the engine (see CLONE_SKIP)
+    if (ref $engine eq 'Compiler::Tools::CopyPasteDetector::Engine') {
+        die("the engine was made with other options than the detector's")
+            unless ($engine->signature eq $options->{signature});
+        return $engine;
     }
-    unlink($tmp_file);
-    return \@deparsed_stmts;
+    $self->{engine} = Compiler::Tools::CopyPasteDetector::Engine->new($self->{jobs}, $options);
+    return $self->{engine};
 }
 
-sub __add_stmt {
-    my ($self, $deparsed_stmts, $stmt, $code, $filename) = @_;
-    my $start_line = $stmt->{start_line};
-    my $end_line = $stmt->{end_line};
-    my $token_num = $stmt->{token_num};
-    my $indent = $stmt->{indent};
-    my $block_id = $stmt->{block_id};
-    my $line_num = $end_line - $start_line;
-    my $stmt_num = (defined($self->{stmt_num_manager}->{"${indent}_${block_id}"})) ?
-        $self->{stmt_num_manager}->{"${indent}_${block_id}"} : 0;
-    my $deparsed_stmt = {
-        hash       => md5_base64($code),
-        src        => encode_base64($code, ""),
-        orig       => $code,
-        file       => $filename,
-        lines      => ($line_num > 0) ? $line_num : 1,
-        start_line => $start_line,
-        end_line   => $end_line,
-        indent     => $indent,
-        block_id   => $block_id,
-        stmt_num   => $stmt_num,
-        token_num  => $token_num,
-        parents     => []
+sub __engine_options {
+    my ($self) = @_;
+    my $needs_tokens = ($self->{deparser} eq 'lexical' || $self->{prefilter});
+    my $options = {
+        deparser     => $self->{deparser},
+        deparse_unit => $self->{deparse_unit},
+        scheduler    => $self->{scheduler},
+        matcher      => $self->{matcher},
+        min_token_num => $self->{min_token_num},
+        min_line_num  => $self->{min_line_num},
+        adaptive     => $self->{auto_jobs},
+        ignore_variable_name => $self->{ignore_variable_name},
+        ignore_literal       => $self->{ignore_literal},
+        prefilter            => $self->{prefilter},
+        token_classes        => ($needs_tokens) ? $self->__token_classes() : undef,
+        cache_dir    => $self->{cache_dir},
+        cache_size   => $self->{cache_size},
+        # the workers lex the files in interpreters which find the modules as we do
+        include_args => [ map { "-I$_"; } grep { !ref $_ } @INC ]
     };
-    my @tmp_deparsed_stmts = ();
-    foreach my $prev_stmt (@$deparsed_stmts) {
-        if ($prev_stmt->{stmt_num} + 1 == $stmt_num &&
-            $prev_stmt->{indent} == $indent &&
-            $prev_stmt->{block_id} == $block_id) {
-            my $src = $prev_stmt->{orig} . "\n" . $deparsed_stmt->{orig};
-            $start_line = $prev_stmt->{start_line};
-            $line_num = $end_line - $start_line;
-            my $new_hash = md5_base64($src);
-            my $parents = $prev_stmt->{parents};
-            my $added_stmt = {
-                hash       => $new_hash,
-                src        => encode_base64($src, ""),
-                orig       => $src,
-                file       => $filename,
-                lines      => ($line_num > 0) ? $line_num : 1,
-                start_line => $start_line,
-                end_line   => $end_line,
-                indent     => $indent,
-                block_id   => $block_id,
-                stmt_num   => $stmt_num,
-                token_num  => $prev_stmt->{token_num} + $token_num,
-                parents     => []
-            };
-            push(@{$added_stmt->{parents}}, @$parents);
-            push(@$parents, $new_hash);
-            push(@tmp_deparsed_stmts, $added_stmt);
-        } elsif ($indent - 1 == $prev_stmt->{indent} &&
-                 $start_line - 1 == $prev_stmt->{start_line}) {
-            # prev_stmt is sub f {} or if () {} or for () {} and so on
-            push(@{$deparsed_stmt->{parents}}, $prev_stmt->{hash});
+    # the engine keeps it to be checked when it is given to another detector
+    $options->{signature} = join("\0", "jobs=$self->{jobs}", map {
+        my $value = $options->{$_};
+        "$_=" . ((ref $value eq 'ARRAY') ? join(' ', @$value) : (defined $value) ? $value : '');
+    } grep { $_ ne 'token_classes' } sort keys %$options);
+    return $options;
+}
+
+# the statements of one file, deparsed by the engine like the files of detect
+sub __get_stmt_data {
+    my ($self, $filename, $script) = @_;
+    my $task = $self->__prepare_task($filename, $script);
+    my $deparsed_stmts = $self->__engine->get_deparsed_stmts([ $task ]);
+    return $$deparsed_stmts;
+}
+
+# classes of the token types for the lexical normalization (see include/cpd/lexical_normalizer.hpp)
+sub __token_classes {
+    my ($self) = @_;
+    my %classes;
+    foreach my $class (keys %LEXICAL_TOKEN_CLASSES) {
+        foreach my $name (@{$LEXICAL_TOKEN_CLASSES{$class}}) {
+            my $type = Compiler::Lexer::TokenType->can($name) or next;
+            $classes{$type->()} = $class;
         }
     }
-    $self->{stmt_num_manager}->{"${indent}_${block_id}"}++;
-    push(@$deparsed_stmts, $deparsed_stmt);
-    push(@$deparsed_stmts, @tmp_deparsed_stmts);
+    return \%classes;
+}
+
+sub __run_process {
+    my ($self, $argv, $input) = @_;
+    open(my $null, '>', File::Spec->devnull());
+    my $pid = open3(my $writer, my $reader, '>&' . fileno($null), @$argv);
+    print $writer $input;
+    close($writer);
+    my $output = do { local $/; <$reader> };
+    waitpid($pid, 0);
+    return ((defined $output) ? $output : '', $?);
 }
 
+# the records keep the range of their code in the text of their detection, so
+# the code and its base64 are made for the clones which are reported only.
 sub __exists_parents {
     my ($self, $matched_values) = @_;
     my %parents_hashmap;
@@ -611,9 +745,18 @@ use Compiler::Tools::CopyPasteDetector;
 
 my @files = qw(file1.pl file2.pl file3.pl);
 my $options = {
-    jobs => 1, # detect by using multi thread
+    jobs => 1, # detect by using multi thread, or 'auto' (as many as the CPUs and the cgroup quota allow)
     min_token_num => 30,
-    min_line_num  => 4
+    min_line_num  => 4,
+    deparser      => 'embedded', # or 'server', 'zygote', 'process' (launches perl for each statement), 'fingerprint' (compares op trees, so unless and if !, which Deparse prints alike, are no clones), 'lexical' (compares tokens without deparse)
+    ignore_literal => 0, # compares statements without their strings and numbers (deparser 'lexical')
+    prefilter     => 0, # 1 deparses only the statements lexically alike another one, which may miss clones Deparse normalizes (e.g. unless and if !). the others are no records and no window runs through them
+    deparse_unit  => 'file', # or 'stmt' (deparses each statement in isolation)
+    scheduler     => 'thread', # or 'event' (one thread keeps 'jobs' processes in flight, deparser 'process' only)
+    matcher       => 'window', # or 'suffix_array' (reports the maximal repeats of the statements across all the files only), 'block' (reports whole statements and blocks only)
+    cache_dir     => '.copy_paste_detector_cache', # keeps deparsed statements across runs
+    engine        => undef, # or the engine of a previous detector with the same options (dies otherwise), which reuses its warm workers
+    cache_size    => 64 * 1024 * 1024 # bytes
 };
 my $detector = Compiler::Tools::CopyPasteDetector->new($options);
 my $data = $detector->detect(\@files);
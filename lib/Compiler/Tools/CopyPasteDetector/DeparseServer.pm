@@ -0,0 +1,35 @@
+package Compiler::Tools::CopyPasteDetector::DeparseServer;
+use strict;
+use warnings;
+use Compiler::Tools::CopyPasteDetector::Deparser;
+
+# request  : "<length>\n<statement source>"
+# response : "<length>\n<deparsed code>", or "-1\n" if the client should
+#            deparse the statement by 'perl -MO=Deparse' instead.
+sub run {
+    my ($compile) = @_;
+    serve($compile, \*STDIN, \*STDOUT);
+}
+
+sub serve {
+    my ($compile, $in, $out) = @_;
+    binmode($in);
+    binmode($out);
+    select((select($out), $| = 1)[0]);
+    while (defined(my $length = <$in>)) {
+        chomp($length);
+        my $src = '';
+        while (length($src) < $length) {
+            last unless read($in, $src, $length - length($src), length($src));
+        }
+        last if (length($src) < $length);
+        my $code = Compiler::Tools::CopyPasteDetector::Deparser::deparse_stmt($compile, $src);
+        if (defined $code) {
+            print $out length($code), "\n", $code;
+        } else {
+            print $out "-1\n";
+        }
+    }
+}
+
+1;
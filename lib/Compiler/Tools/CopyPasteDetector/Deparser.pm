@@ -0,0 +1,97 @@
+package Compiler::Tools::CopyPasteDetector::Deparser;
+use strict;
+use warnings;
+use B qw(svref_2object OPf_KIDS);
+use B::Deparse;
+our @ISA = qw(B::Deparse);
+
+# 'sub { eval $_[0] }' of an embedded interpreter (see src/cpd/deparse_interpreter.cpp)
+our $COMPILE;
+
+# statements which have side effects at compile time (or get extra
+# BEGIN blocks from perl) can't share an interpreter with others.
+# these are deparsed by 'perl -MO=Deparse' as before.
+my $COMPILE_TIME_PATTERN = qr/
+    \b(?:sub\s+[\w:']+|BEGIN|UNITCHECK|CHECK|INIT|END|use|no|package|format|__END__|__DATA__)\b |
+    \\N\s*\{ | %! | \$!\s*\{
+/x;
+
+# $compile must be 'sub { eval $_[0] }' created by the '-e' program of the
+# deparse command, so that statements are compiled under the same pragmas
+# as 'perl -M... -MO=Deparse -e'.
+# returns the statement as the body of an anonymous sub followed by ';return;'
+sub compile_stmt {
+    my ($compile, $src) = @_;
+    return undef if ($src =~ $COMPILE_TIME_PATTERN);
+    local $@;
+    local $SIG{__WARN__} = sub {};
+    my $begin_num = __begin_block_num();
+    my $code = $compile->(qq{package main; sub {\n#line 1 "-e"\n$src\n;return;\n}});
+    # broken source is left to 'perl -MO=Deparse' too, because it outputs
+    # whatever it could parse
+    return undef if (ref $code ne 'CODE' || __begin_block_num() != $begin_num);
+    return $code;
+}
+
+sub deparse_stmt {
+    my ($compile, $src) = @_;
+    my $code = compile_stmt($compile, $src);
+    return undef unless (defined $code);
+    my $cv = svref_2object($code);
+    my $self = __PACKAGE__->new();
+    $self->{curcv} = $cv;
+    $self->{curcvlex} = undef;
+    $self->{stmt_cv} = $cv;
+    local $B::overlay = {};
+    my $root = $cv->ROOT;
+    $self->pad_subs($cv);
+    $self->pessimise($root, $cv->START);
+    my @ops;
+    for (my $op = $root->first->first; $$op; $op = $op->sibling) {
+        push(@ops, $op);
+    }
+    # drop ';return;' which makes the last statement void context
+    splice(@ops, -2) if (@ops >= 2 && $ops[-1]->name eq 'return');
+    my $text = '';
+    $self->walk_lineseq(undef, \@ops, sub {
+        return unless length $_[0];
+        $text .= $self->indent($_[0] . ';');
+        $text .= "\n" unless ($_[1] == $#ops);
+    });
+    return undef if (@{$self->{subs_todo}} || $self->{has_glob});
+    return '' if ($text eq '');
+    utf8::encode($text) if (utf8::is_utf8($text));
+    return "$text\n";
+}
+
+### ============= B::Deparse Overrides ================== ###
+
+# 'shift' and 'pop' of statement's top level refer to @ARGV in 'perl -e'
+sub pp_shift { $_[0]->__argv_unop(@_[1, 2], 'shift') }
+sub pp_pop   { $_[0]->__argv_unop(@_[1, 2], 'pop') }
+
+# glob() makes perl load File::Glob, which 'perl -MO=Deparse' outputs
+sub pp_glob {
+    my $self = shift;
+    $self->{has_glob} = 1;
+    return $self->SUPER::pp_glob(@_);
+}
+
+### ================ Private Methods ===================== ###
+
+sub __argv_unop {
+    my ($self, $op, $cx, $name) = @_;
+    if (($op->flags & OPf_KIDS) || ${$self->{curcv}} != ${$self->{stmt_cv}}) {
+        return $self->unop($op, $cx, $name);
+    }
+    return ($cx > 16 || $self->{parens}) ? "$name(\@ARGV)" : "$name \@ARGV";
+}
+
+sub __begin_block_num {
+    my $begin_av = B::begin_av;
+    return 0 unless ($begin_av->isa('B::AV'));
+    my @blocks = $begin_av->ARRAY;
+    return scalar @blocks;
+}
+
+1;
@@ -0,0 +1,19 @@
+package Compiler::Tools::CopyPasteDetector::FileDeparseHooker;
+use strict;
+use warnings;
+use B::Deparse;
+
+# loaded by 'perl -MO=Deparse,-l' of deparse_unit => 'file'.
+# subs and pragmas are printed between a statement and the '#line' marker
+# of the next one, so a '#line 0' marker is put before them to cut them
+# off from the previous statement.
+my $pp_nextstate = \&B::Deparse::pp_nextstate;
+{
+    no warnings 'redefine';
+    *B::Deparse::pp_nextstate = sub {
+        my $text = $pp_nextstate->(@_);
+        return (index($text, "\f#line ") > 0) ? "\f#line 0\n$text" : $text;
+    };
+}
+
+1;
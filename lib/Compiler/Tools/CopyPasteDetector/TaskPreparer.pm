@@ -0,0 +1,75 @@
+package Compiler::Tools::CopyPasteDetector::TaskPreparer;
+use strict;
+use warnings;
+use Compiler::Lexer;
+
+# lexes the files into the tasks of the engine. it is loaded by the interpreters embedded in
+# the workers of the engine (see src/cpd/task_interpreter.cpp), which read and lex the files
+# given to the engine by their names, without the reports of Compiler::Tools::CopyPasteDetector
+my %options;
+
+sub setup {
+    my ($deparser, $prefilter, $ignore_variable_name) = @_;
+    %options = (
+        deparser             => $deparser,
+        prefilter            => $prefilter,
+        ignore_variable_name => $ignore_variable_name
+    );
+}
+
+# the used modules are given back to the caller of the engine, which makes the commands of the files
+sub prepare_task {
+    my ($filename) = @_;
+    return lex_task(\%options, $filename);
+}
+
+# the task of the file (or its script if given) by the deparser, prefilter and ignore_variable_name of $options.
+# a module is "name" or "name args", and the statements of 'lexical' aren't deparsed by them
+sub lex_task {
+    my ($options, $filename, $script) = @_;
+    my $is_lexical = ($options->{deparser} eq 'lexical');
+    my $needs_tokens = ($is_lexical || $options->{prefilter});
+    $script = read_script($filename) unless (defined $script);
+    my $lexer = Compiler::Lexer->new($filename);
+    my $tokens = $lexer->tokenize($script);
+    if ($options->{ignore_variable_name}) {
+        ignore_orthographic_variation_of_variable_name($tokens);
+    }
+    my $stmts = $lexer->get_groups_by_syntax_level($tokens, Compiler::Lexer::SyntaxType::T_Stmt);
+    my @modules = ($is_lexical) ? () : map {
+        (defined $_->{args}) ? "$_->{name} $_->{args}" : $_->{name};
+    } @{$lexer->get_used_modules($script)};
+    return {filename => $filename, stmts => $stmts, modules => \@modules, ($needs_tokens) ? (tokens => $tokens) : ()};
+}
+
+sub read_script {
+    my ($filename) = @_;
+    my $script = "";
+    open(FP, "<", $filename) or die("Error");
+    $script .= $_ foreach (<FP>);
+    close(FP);
+    return $script;
+}
+
+sub ignore_orthographic_variation_of_variable_name {
+    my ($tokens) = @_;
+    my @variables = (
+        Compiler::Lexer::TokenType::T_Var,
+        Compiler::Lexer::TokenType::T_CodeVar,
+        Compiler::Lexer::TokenType::T_ArrayVar,
+        Compiler::Lexer::TokenType::T_HashVar,
+        Compiler::Lexer::TokenType::T_LocalVar,
+        Compiler::Lexer::TokenType::T_LocalArrayVar,
+        Compiler::Lexer::TokenType::T_LocalHashVar,
+        Compiler::Lexer::TokenType::T_GlobalVar,
+        Compiler::Lexer::TokenType::T_GlobalArrayVar,
+        Compiler::Lexer::TokenType::T_GlobalHashVar
+    );
+    foreach my $token (@$tokens) {
+        if (grep { $_ == $token->{type} } @variables) {
+            $token->{data} = substr($token->{data}, 0, 1) . "v";
+        }
+    }
+}
+
+1;
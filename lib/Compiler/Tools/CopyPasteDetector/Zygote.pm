@@ -0,0 +1,64 @@
+package Compiler::Tools::CopyPasteDetector::Zygote;
+use strict;
+use warnings;
+use POSIX ();
+use Socket qw(SOL_SOCKET SO_PEERCRED);
+use Compiler::Tools::CopyPasteDetector::DeparseServer;
+
+# started by src/cpd/zygote.cpp after the modules of its command are loaded.
+# fd 0     : listening unix socket in a private directory. each connection of
+#            our user gets a forked DeparseServer, which shares the loaded
+#            modules by copy-on-write.
+# fd 3     : control pipe. the zygote exits by its EOF.
+# $ARGV[0] : the most children at once. the other connections wait until
+#            a child exits (by EOF of its connection).
+sub run {
+    my ($compile) = @_;
+    my $max_child_num = (@ARGV && $ARGV[0] =~ /^\d+$/ && $ARGV[0] > 0) ? $ARGV[0] : 1;
+    open(my $listener, '+<&=', 0) or die "listener: $!";
+    open(my $control, '<&=', 3) or die "control: $!";
+    my %children;
+    while (1) {
+        my $rin = '';
+        vec($rin, fileno($listener), 1) = 1;
+        vec($rin, fileno($control), 1) = 1;
+        next if (select(my $rout = $rin, undef, undef, undef) <= 0);
+        last if (vec($rout, fileno($control), 1));
+        __reap(\%children, $max_child_num);
+        next unless (accept(my $client, $listener));
+        next unless (__is_our_user($client));
+        my $pid = fork();
+        if (defined $pid && $pid == 0) {
+            close($listener);
+            close($control);
+            Compiler::Tools::CopyPasteDetector::DeparseServer::serve($compile, $client, $client);
+            POSIX::_exit(0);
+        }
+        $children{$pid} = 1 if (defined $pid);
+        close($client);
+    }
+}
+
+# waits for a child to exit while max_child_num children are running
+sub __reap {
+    my ($children, $max_child_num) = @_;
+    while ((my $pid = waitpid(-1, POSIX::WNOHANG())) > 0) {
+        delete $children->{$pid};
+    }
+    while (keys %$children >= $max_child_num) {
+        my $pid = waitpid(-1, 0);
+        last if ($pid <= 0);
+        delete $children->{$pid};
+    }
+}
+
+# struct ucred { pid_t pid; uid_t uid; gid_t gid; }
+sub __is_our_user {
+    my ($client) = @_;
+    my $cred = getsockopt($client, SOL_SOCKET, SO_PEERCRED);
+    return 0 unless (defined $cred);
+    my (undef, $uid) = unpack('iII', $cred);
+    return $uid == $<;
+}
+
+1;
@@ -1,5 +1,21 @@
 #include <clx/md5.h>
-#include <clx/base64.h>
+#include <cpd/arena.hpp>
+#include <cpd/cpu_quota.hpp>
+#include <cpd/deparse_cache.hpp>
+#include <cpd/deparse_server.hpp>
+#include <cpd/deparse_interpreter.hpp>
+#include <cpd/file_deparser.hpp>
+#include <cpd/lexical_normalizer.hpp>
+#include <cpd/lexical_prefilter.hpp>
+#include <cpd/process.hpp>
+#include <cpd/process_multiplexer.hpp>
+#include <cpd/repeat_finder.hpp>
+#include <cpd/stmt_dictionary.hpp>
+#include <cpd/task_interpreter.hpp>
+#include <cpd/work_stealing_scheduler.hpp>
+#include <cpd/worker_pool.hpp>
+#include <cpd/zygote.hpp>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -23,255 +39,1071 @@ extern "C" {
 };
 #endif
 #include <pthread.h>
-#define MAX_JOB_NUM 32
+#include <signal.h>
+#include <sys/stat.h>
+#define MAX_SERVER_NUM_PER_THREAD 8
+#define MAX_INTERPRETER_NUM_PER_THREAD 8
+#define MAX_ZYGOTE_CHILD_NUM_PER_THREAD 8
+#define ZYGOTE_BATCH_SIZE 64
+#define DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
 #define get_value(hash, key) *hv_fetchs(hash, key, strlen(key))
 
 using namespace std;
 
-class Stmt {
+typedef enum {
+	DeparseByProcess,
+	DeparseByServer,
+	DeparseByInterpreter,
+	DeparseByZygote,
+	DeparseByFingerprint,
+	DeparseByLexer
+} DeparseMode;
+
+typedef enum {
+	MatchByWindow,
+	MatchBySuffixArray,
+	MatchByBlock
+} MatchMode;
+
+static StmtHash digest(const char *data, size_t size)
+{
+	clx::md5 md5;
+	md5.encode(data, size);
+	StmtHash hash;
+	memcpy(hash.bytes, md5.code(), STMT_HASH_SIZE);
+	return hash;
+}
+
+/* the hashes of the deparsers and of the cache are md5 in hex */
+static StmtHash decode_hex(const string &hex)
+{
+	StmtHash hash;
+	for (size_t i = 0; i < STMT_HASH_SIZE && i * 2 + 1 < hex.size(); i++) {
+		hash.bytes[i] = (unsigned char)strtoul(hex.substr(i * 2, 2).c_str(), NULL, 16);
+	}
+	return hash;
+}
+
+/*
+ * the hash of a window is the one of the window without its last statement combined with
+ * the hash of the statement, so a window is hashed in constant time whatever its length.
+ * windows of the same statements in the same order have the same hash.
+ */
+static StmtHash combine(const StmtHash &prev_hash, const StmtHash &hash)
+{
+	char combined[STMT_HASH_SIZE * 2 + 1];
+	memcpy(combined, prev_hash.bytes, STMT_HASH_SIZE);
+	combined[STMT_HASH_SIZE] = '\n';
+	memcpy(combined + STMT_HASH_SIZE + 1, hash.bytes, STMT_HASH_SIZE);
+	return digest(combined, sizeof(combined));
+}
+
+/* orders the statements by their files and their blocks, and by their numbers in a block */
+class BlockOrder {
 public:
-	const char *src;
-	const char *filename;
-	const char *full_cmd;
-	const char *normal_cmd;
-	int token_num;
-	int indent;
-	int block_id;
-	int start_line;
-	int end_line;
-	int has_warnings;
-	Stmt(const char *src_, int token_num_, int indent_, int block_id_,
-		 int start_line_, int end_line_, int has_warnings_) :
-		src(src_), token_num(token_num_), indent(indent_), block_id(block_id_),
-		start_line(start_line_), end_line(end_line_), has_warnings(has_warnings_) {}
+	bool operator()(const DeparsedStmt *a, const DeparsedStmt *b) const {
+		if (a->file_id != b->file_id) return a->file_id < b->file_id;
+		if (a->indent != b->indent) return a->indent < b->indent;
+		if (a->block_id != b->block_id) return a->block_id < b->block_id;
+		return a->stmt_num < b->stmt_num;
+	}
 };
 
-class DeparsedStmt {
+/* the records of a task added so far, indexed by add_stmt() with their positions in the records */
+class StmtIndex {
 public:
-	const char *hash;
-	const char *src;
-	const char *orig;
-	const char *file;
-	int lines;
-	int start_line;
-	int end_line;
-	int indent;
-	int block_id;
-	int stmt_num;
-	int token_num;
-	vector<const char *> parents;
-	DeparsedStmt(const char *hash_, const char *src_, const char *orig_, const char *file_,
-				 int lines_,     int start_line_, int end_line_,
-				 int indent_,    int block_id_,   int stmt_num_,
-				 int token_num_) :
-		hash(hash_), src(src_), orig(orig_), file(file_),
-		lines(lines_), start_line(start_line_), end_line(end_line_),
-		indent(indent_), block_id(block_id_), stmt_num(stmt_num_),
-		token_num(token_num_) {}
+	bool makes_windows; /* or the statements are added alone, for their repeats or their blocks (see find_repeats, add_blocks) */
+	map<pair<int, int>, int> stmt_nums; /* (indent, block_id) => the number of the next statement */
+	/* (indent, block_id) => the statement and the windows which end at the last statement of the block */
+	map<pair<int, int>, vector<size_t> > open_windows;
+	/* (indent, start_line) => the records, as the candidates of the parents of the statements below */
+	map<pair<int, int>, vector<size_t> > starts;
+	StmtDictionary *dictionary; /* where the statements are interned, if given */
+	StmtIndex(bool makes_windows_, StmtDictionary *dictionary_) :
+		makes_windows(makes_windows_), dictionary(dictionary_) {}
 };
 
-typedef vector<Stmt *> Task;
+/* the positions of the records which start at start_line with indent, in [begin, end) */
+static void find_starts(const StmtIndex &index, int indent, int start_line, size_t begin, size_t end,
+						vector<size_t> *positions)
+{
+	map<pair<int, int>, vector<size_t> >::const_iterator it = index.starts.find(make_pair(indent, start_line));
+	if (it == index.starts.end()) return;
+	const vector<size_t> &starts = it->second;
+	for (vector<size_t>::const_iterator start = lower_bound(starts.begin(), starts.end(), begin);
+		 start != starts.end() && *start < end; start++) {
+		positions->push_back(*start);
+	}
+}
 
-static void add_stmt(vector<DeparsedStmt *> *deparsed_stmts, Stmt *stmt, string code, map<string, int> *stmt_num_manager)
+/*
+ * the code of stmt is [text_offset, text_offset + text_size) of text (see layout_codes).
+ * hash is given if it isn't the one of the code (e.g. a fingerprint).
+ * is_source: code is the source of the lexer, which is deparsed by the report.
+ *
+ * the windows which end at the previous statement of the block are extended by stmt, and the
+ * records one indent above which start on the line before stmt are its parents. as the records
+ * were once scanned in their order, a record after an extended window is the parent if it starts
+ * on the line before that window, so the parents are looked up between the extended windows.
+ */
+static void add_stmt(Arena *arena, vector<DeparsedStmt *> *deparsed_stmts, Stmt *stmt, const string &text,
+					 size_t text_offset, size_t text_size, const string &hash,
+					 StmtIndex *index, bool is_source)
 {
-	const char *filename = stmt->filename;
 	int token_num = stmt->token_num;
 	int indent = stmt->indent;
 	int block_id = stmt->block_id;
 	int start_line = stmt->start_line;
 	int end_line = stmt->end_line;
 	int line_num = end_line - start_line;
-	char manager_key[32] = {0};
-	snprintf(manager_key, 32, "%d_%d", indent, block_id);
-	map<string, int>::iterator it = stmt_num_manager->find(string(manager_key));
-	int stmt_num;
-	if (it == stmt_num_manager->end()) {
-		stmt_num_manager->insert(map<string, int>::value_type(string(manager_key), 0));
-		stmt_num = 0;
-	} else {
-		stmt_num = (*it).second;
+	pair<int, int> block(indent, block_id);
+	int stmt_num = index->stmt_nums[block];
+	StmtHash stmt_hash = (hash.empty()) ? digest(text.data() + text_offset, text_size) : decode_hex(hash);
+	DeparsedStmt *deparsed_stmt = new (arena->allocate(sizeof(DeparsedStmt)))
+		DeparsedStmt(stmt_hash, text_offset, text_size, is_source,
+					 (line_num > 0) ? line_num : 1,
+					 start_line, end_line,
+					 indent, block_id, stmt_num, token_num);
+	deparsed_stmt->has_warnings = stmt->has_warnings;
+	index->stmt_nums[block] = stmt_num + 1;
+	if (index->dictionary) deparsed_stmt->stmt_id = index->dictionary->add(stmt_hash);
+	if (!index->makes_windows) {
+		deparsed_stmts->push_back(deparsed_stmt);
+		return;
 	}
-	clx::md5 md5;
-	DeparsedStmt *deparsed_stmt = new DeparsedStmt((new string(md5.encode(code).to_string()))->c_str(),
-												   (new string(clx::base64::encode(code)))->c_str(),
-												   (new string(code))->c_str(),
-												   filename, (line_num > 0) ? line_num : 1,
-												   start_line, end_line,
-												   indent, block_id, stmt_num, token_num);
-	vector<DeparsedStmt *> tmp_deparsed_stmts;
-	for (size_t i = 0; i < deparsed_stmts->size(); i++) {
-		DeparsedStmt *prev_stmt = deparsed_stmts->at(i);
-		if (prev_stmt->stmt_num + 1 == stmt_num &&
-			prev_stmt->indent == indent && prev_stmt->block_id == block_id) {
-			string src = string(prev_stmt->orig) + "\n" + string(deparsed_stmt->orig);
-			start_line = prev_stmt->start_line;
-			line_num = end_line - start_line;
-			const char *new_hash = (new string(md5.encode(src).to_string()))->c_str();
-			DeparsedStmt *added_stmt = new DeparsedStmt(new_hash,
-														(new string(clx::base64::encode(src)))->c_str(),
-														(new string(src))->c_str(),
-														filename, (line_num > 0) ? line_num : 1,
-														start_line, end_line,
-														indent, block_id, stmt_num,
-														prev_stmt->token_num + token_num);
-			added_stmt->parents.insert(added_stmt->parents.end(),
-									   prev_stmt->parents.begin(), prev_stmt->parents.end());
-			prev_stmt->parents.push_back(new_hash);
-			tmp_deparsed_stmts.push_back(added_stmt);
-		} else if (indent - 1 == prev_stmt->indent && start_line - 1 == prev_stmt->start_line) {
-			//fprintf(stderr, "parent = [%s]\n", prev_stmt->orig);
-			//fprintf(stderr, "stmt = [%s]\n", deparsed_stmt->orig);
-			deparsed_stmt->parents.push_back(prev_stmt->hash);
-		}
-	}
-	stmt_num++;
-	it = stmt_num_manager->find(string(manager_key));
-	(*it).second = stmt_num;
+	vector<size_t> &open_windows = index->open_windows[block];
+	vector<size_t> parents;
+	size_t begin = 0;
+	for (size_t i = 0; i < open_windows.size(); i++) {
+		find_starts(*index, indent - 1, start_line - 1, begin, open_windows.at(i), &parents);
+		start_line = deparsed_stmts->at(open_windows.at(i))->start_line;
+		begin = open_windows.at(i) + 1;
+	}
+	find_starts(*index, indent - 1, start_line - 1, begin, deparsed_stmts->size(), &parents);
+	for (size_t i = 0; i < parents.size(); i++) {
+		deparsed_stmt->add_parent(arena, &deparsed_stmts->at(parents.at(i))->hash);
+	}
+	vector<size_t> windows(1, deparsed_stmts->size());
 	deparsed_stmts->push_back(deparsed_stmt);
-	deparsed_stmts->insert(deparsed_stmts->end(), tmp_deparsed_stmts.begin(), tmp_deparsed_stmts.end());
+	for (size_t i = 0; i < open_windows.size(); i++) {
+		DeparsedStmt *prev_stmt = deparsed_stmts->at(open_windows.at(i));
+		/* the window runs from the code of prev_stmt to the one of stmt, with the newlines between */
+		size_t window_size = text_offset + text_size - prev_stmt->text_offset;
+		start_line = prev_stmt->start_line;
+		line_num = end_line - start_line;
+		DeparsedStmt *added_stmt = new (arena->allocate(sizeof(DeparsedStmt)))
+			DeparsedStmt(combine(prev_stmt->hash, stmt_hash), prev_stmt->text_offset, window_size,
+						 is_source || prev_stmt->is_source,
+						 (line_num > 0) ? line_num : 1,
+						 start_line, end_line,
+						 indent, block_id, stmt_num,
+						 prev_stmt->token_num + token_num);
+		added_stmt->has_warnings = prev_stmt->has_warnings || deparsed_stmt->has_warnings;
+		for (ParentHash *parent = prev_stmt->parents; parent; parent = parent->next) {
+			added_stmt->add_parent(arena, parent->hash);
+		}
+		prev_stmt->add_parent(arena, &added_stmt->hash);
+		windows.push_back(deparsed_stmts->size());
+		deparsed_stmts->push_back(added_stmt);
+	}
+	for (size_t i = 0; i < windows.size(); i++) {
+		DeparsedStmt *window = deparsed_stmts->at(windows.at(i));
+		index->starts[make_pair(window->indent, window->start_line)].push_back(windows.at(i));
+	}
+	open_windows.swap(windows);
 }
 
-static void set_deparsed_stmts(vector<DeparsedStmt *> *deparsed_stmts, Task *task,
-							   const char *tmp_file_name, size_t stmts_size)
+/*
+ * appends the codes of the statements to text block by block, so a window of a block
+ * is a range of text. codes and offsets are indexed by the statement, and NULL codes are skipped.
+ */
+static void layout_codes(const vector<Stmt *> &stmts, const vector<const string *> &codes,
+						 string *text, vector<size_t> *offsets)
 {
-	map<string, int> stmt_num_manager;
-	for (size_t i = 0; i < stmts_size; i++) {
-		Stmt *stmt = task->at(i);
-		const char *src = stmt->src;
-		const char *cmd = (stmt->has_warnings) ? stmt->full_cmd : stmt->normal_cmd;
-		size_t cmd_len = strlen(cmd) + strlen(src) + 128;
-		char cmd_buf[cmd_len];
-		bool is_else = false;
-		bool is_elsif = false;
-		if (string(src).find("else") == 1) {
-			src += 5;
-			is_else = true;
-		} else if (string(src).find("elsif") == 1) {
-			src += 4;
-			is_elsif = true;
-		}
-		snprintf(cmd_buf, cmd_len, "%s -e '%s' 2> /dev/null", cmd, src);
-		FILE *fp = popen(cmd_buf, "r");
-		char read_buf[128] = {0};
-		if (!fp) {
-			perror("popen");
-			exit(EXIT_FAILURE);
-		}
-		string code = "";
-		if (is_else) {
-			code = "else ";
-		} else if (is_elsif) {
-			code = "els";
-		}
-		while ((fgets(read_buf , 128 , fp)) != NULL) {
-			code += string(read_buf);
-		}
-		pclose(fp);
+	map<pair<int, int>, vector<size_t> > blocks;
+	size_t text_size = 0;
+	for (size_t i = 0; i < codes.size(); i++) {
+		if (!codes.at(i)) continue;
+		blocks[make_pair(stmts.at(i)->indent, stmts.at(i)->block_id)].push_back(i);
+		text_size += codes.at(i)->size() + 1;
+	}
+	text->reserve(text_size);
+	offsets->resize(codes.size(), 0);
+	for (map<pair<int, int>, vector<size_t> >::iterator it = blocks.begin(); it != blocks.end(); it++) {
+		const vector<size_t> &block = it->second;
+		for (size_t i = 0; i < block.size(); i++) {
+			if (i > 0) *text += "\n";
+			offsets->at(block.at(i)) = text->size();
+			*text += *codes.at(block.at(i));
+		}
+	}
+}
+
 #ifdef DEBUG_MODE
-		if (code == "" || code == "'???';\n" || code == ";\n") {
-			memset(cmd_buf, 0, cmd_len);
-			snprintf(cmd_buf, cmd_len, "%s -e '%s'", cmd, src);
-			system(cmd_buf);
-			fprintf(stderr, "%s\n", stmt->filename);
-			fprintf(stderr, "cmd : [%s]\n", cmd_buf);
-			fprintf(stderr, "orig : [%s]\n", src);
+static string quote_source(const char *src)
+{
+	string quoted = "'";
+	for (const char *p = src; *p; p++) {
+		if (*p == '\'') {
+			quoted += "'\\''";
+		} else {
+			quoted += *p;
 		}
+	}
+	return quoted + "'";
+}
 #endif
-		if (code == "" || code == "'???';\n" || code == ";\n") continue;
-		code.erase(code.size() - 1);
-		add_stmt(deparsed_stmts, stmt, code, &stmt_num_manager);
+
+static string deparse_by_process(const DeparseCommand *cmd, const char *src)
+{
+	string code = "";
+	run_process(cmd->argv, cmd->stdin_header + src + "\n", &code);
+	return code;
+}
+
+/* 'else' and 'elsif' can't be deparsed alone, so they are deparsed as a block and 'if' */
+static const char *strip_branch(const char *src, string *prefix)
+{
+	if (string(src).find("else") == 1) {
+		*prefix = "else ";
+		return src + 5;
+	} else if (string(src).find("elsif") == 1) {
+		*prefix = "els";
+		return src + 4;
 	}
+	*prefix = "";
+	return src;
+}
+
+static void deparse_file(Task *task, map<size_t, string> *file_codes)
+{
+	if (task->file_argv.empty() || task->stmts.empty()) return;
+	FileDeparser file_deparser;
+	if (file_deparser.deparse(task->file_argv, task->filename)) {
+		file_deparser.assign(task, file_codes);
+	}
+}
+
+/* source of the lexer without the spaces around it, which stands for the code of a fingerprinted statement */
+static string trim_source(const char *src)
+{
+	string text = src;
+	size_t begin = text.find_first_not_of(" \t\n");
+	if (begin == string::npos) return "";
+	return text.substr(begin, text.find_last_not_of(" \t\n") - begin + 1);
+}
+
+/*
+ * the parents of a record are the longer records which end where it ends (start_line + lines),
+ * in the order of the records. the records are joined by their ends instead of compared in pairs.
+ */
+static void set_parents(Arena *arena, vector<DeparsedStmt *> *deparsed_stmts)
+{
+	map<int, vector<DeparsedStmt *> > ends;
 	for (size_t i = 0; i < deparsed_stmts->size(); i++) {
 		DeparsedStmt *stmt = deparsed_stmts->at(i);
-		int start_line = stmt->start_line;
-		int lines = stmt->lines;
-		vector<const char *> parents;
-		for (size_t j = 0; j < deparsed_stmts->size(); j++) {
-			DeparsedStmt *another_stmt = deparsed_stmts->at(j);
-			if ((another_stmt->start_line == start_line - (another_stmt->lines - lines)) &&
-				(another_stmt->lines > stmt->lines)) {
-				parents.push_back(another_stmt->hash);
-			}
+		ends[stmt->start_line + stmt->lines].push_back(stmt);
+	}
+	for (size_t i = 0; i < deparsed_stmts->size(); i++) {
+		DeparsedStmt *stmt = deparsed_stmts->at(i);
+		const vector<DeparsedStmt *> &another_stmts = ends[stmt->start_line + stmt->lines];
+		for (size_t j = 0; j < another_stmts.size(); j++) {
+			DeparsedStmt *another_stmt = another_stmts.at(j);
+			if (another_stmt->lines > stmt->lines) stmt->add_parent(arena, &another_stmt->hash);
+		}
+	}
+}
+
+/* the statement one indent above whose lines enclose [start_line, end_line], or NULL */
+static DeparsedStmt *find_enclosing(const map<int, map<int, DeparsedStmt *> > &starts, int indent,
+									int start_line, int end_line)
+{
+	map<int, map<int, DeparsedStmt *> >::const_iterator it = starts.find(indent - 1);
+	if (it == starts.end()) return NULL;
+	map<int, DeparsedStmt *>::const_iterator start = it->second.upper_bound(start_line);
+	if (start == it->second.begin()) return NULL;
+	start--;
+	return (start->second->end_line >= end_line) ? start->second : NULL;
+}
+
+/*
+ * adds a record for each block of two statements or more, whose hash is the merkle hash of its
+ * statements: their hashes combined in order, like the window of the whole block (see add_stmt).
+ * a statement hashes the code of its own blocks, so the hashes of the blocks are found bottom-up.
+ * the parent of a block is the statement which encloses its lines one indent above, and the parent
+ * of a statement is its block, or the statement enclosing its block if it is alone in the block.
+ */
+static void add_blocks(Arena *arena, vector<DeparsedStmt *> *deparsed_stmts)
+{
+	vector<DeparsedStmt *> stmts = *deparsed_stmts;
+	sort(stmts.begin(), stmts.end(), BlockOrder());
+	/* indent => start_line => the statement, the longest one if some start on the same line */
+	map<int, map<int, DeparsedStmt *> > starts;
+	for (size_t i = 0; i < stmts.size(); i++) {
+		DeparsedStmt *stmt = stmts.at(i);
+		DeparsedStmt *&start = starts[stmt->indent][stmt->start_line];
+		if (!start || start->end_line < stmt->end_line) start = stmt;
+	}
+	for (size_t begin = 0, end = 0; begin < stmts.size(); begin = end) {
+		DeparsedStmt *first = stmts.at(begin);
+		StmtHash hash = first->hash;
+		int token_num = first->token_num;
+		bool is_source = first->is_source;
+		bool has_warnings = first->has_warnings;
+		for (end = begin + 1; end < stmts.size(); end++) {
+			DeparsedStmt *stmt = stmts.at(end);
+			if (stmt->indent != first->indent || stmt->block_id != first->block_id) break;
+			hash = combine(hash, stmt->hash);
+			token_num += stmt->token_num;
+			is_source = is_source || stmt->is_source;
+			has_warnings = has_warnings || stmt->has_warnings;
+		}
+		DeparsedStmt *last = stmts.at(end - 1);
+		DeparsedStmt *enclosing = find_enclosing(starts, first->indent, first->start_line, last->end_line);
+		if (end - begin == 1) {
+			if (enclosing) first->add_parent(arena, &enclosing->hash);
+			continue;
 		}
-		stmt->parents.insert(stmt->parents.end(), parents.begin(), parents.end());
+		int line_num = last->end_line - first->start_line;
+		DeparsedStmt *block = new (arena->allocate(sizeof(DeparsedStmt)))
+			DeparsedStmt(hash, first->text_offset, last->text_offset + last->text_size - first->text_offset,
+						 is_source,
+						 (line_num > 0) ? line_num : 1,
+						 first->start_line, last->end_line,
+						 first->indent, first->block_id, last->stmt_num,
+						 token_num);
+		block->has_warnings = has_warnings;
+		if (enclosing) block->add_parent(arena, &enclosing->hash);
+		for (size_t i = begin; i < end; i++) {
+			stmts.at(i)->add_parent(arena, &block->hash);
+		}
+		deparsed_stmts->push_back(block);
 	}
 }
 
+/* the code of a statement given by a worker, which is added in the order of its file */
+typedef struct _StmtCode {
+	bool is_empty; /* deparsed to nothing, so the statement is skipped */
+	bool is_unique; /* alone in its bucket of the prefilter, so it isn't deparsed */
+	string code;
+	string hash;
+	bool is_source;
+} StmtCode;
+
+/* nothing is deparsed, or B::Deparse has failed (it deparses some statements to '???') */
+static bool is_empty_code(const string &code)
+{
+	return code == "" || code == "'?\?\?';\n" || code == ";\n";
+}
+
+/* process_codes are the codes already deparsed by processes, or NULL */
+static void deparse_stmt(StmtCode *stmt_code, Task *task, size_t i,
+						 Deparser *deparser, const map<size_t, string> &file_codes,
+						 const map<size_t, string> *process_codes,
+						 const DeparseCache *cache, DeparseCacheJournal *journal)
+{
+	Stmt *stmt = task->stmts.at(i);
+	stmt_code->is_empty = true;
+	stmt_code->is_unique = false;
+	stmt_code->is_source = false;
+	map<size_t, string>::const_iterator file_code = file_codes.find(i);
+	if (file_code != file_codes.end()) {
+		string code = file_code->second;
+		if (is_empty_code(code)) return;
+		code.erase(code.size() - 1);
+		stmt_code->code = code;
+		stmt_code->is_empty = false;
+		return;
+	}
+	if (stmt->is_unique) {
+		/* the position stands for the hash, which matches no other statement */
+		char position[32] = {0};
+		snprintf(position, sizeof(position), ":%d", stmt->start_line);
+		clx::md5 md5;
+		stmt_code->code = trim_source(stmt->src);
+		stmt_code->hash = md5.encode(string(stmt->filename) + position).to_string();
+		stmt_code->is_source = true;
+		stmt_code->is_empty = false;
+		stmt_code->is_unique = true;
+		return;
+	}
+	const DeparseCommand *cmd = (stmt->has_warnings) ? stmt->full_cmd : stmt->normal_cmd;
+	string code;
+	const char *src = strip_branch(stmt->src, &code);
+	string deparsed_code;
+	string hash;
+	if (deparser && deparser->fingerprint(cmd, src, &hash)) {
+		/* the code is deparsed from the source by the report, only if it is a clone */
+		if (hash.empty()) return;
+		clx::md5 md5;
+		if (!code.empty()) hash = md5.encode(code + hash).to_string();
+		stmt_code->code = trim_source(stmt->src);
+		stmt_code->hash = hash;
+		stmt_code->is_source = true;
+		stmt_code->is_empty = false;
+		return;
+	}
+	if (!cache || !cache->lookup(DeparseCacheKey(cmd, src), &deparsed_code, &hash, journal)) {
+		map<size_t, string>::const_iterator process_code;
+		if (process_codes && (process_code = process_codes->find(i)) != process_codes->end()) {
+			deparsed_code = process_code->second;
+		} else if (!deparser || !deparser->deparse(cmd, src, &deparsed_code)) {
+			deparsed_code = deparse_by_process(cmd, src);
+		}
+		/* a failure (e.g. a crash or a missing module) is deparsed again by the next run */
+		if (cache && !is_empty_code(deparsed_code)) hash = journal->add(DeparseCacheKey(cmd, src), deparsed_code);
+	}
+	/* the hash of the cache is the one of deparsed_code, so it can't be used with a prefix */
+	if (!code.empty()) hash = "";
+	code += deparsed_code;
+#ifdef DEBUG_MODE
+	if (is_empty_code(code)) {
+		string cmd_buf = string(cmd->process) + " -e " + quote_source(src);
+		system(cmd_buf.c_str());
+		fprintf(stderr, "%s\n", stmt->filename);
+		fprintf(stderr, "cmd : [%s]\n", cmd_buf.c_str());
+		fprintf(stderr, "orig : [%s]\n", src);
+	}
+#endif
+	if (is_empty_code(code)) return;
+	code.erase(code.size() - 1);
+	stmt_code->code = code;
+	stmt_code->hash = hash;
+	stmt_code->is_empty = false;
+}
+
+static void add_stmt_codes(Arena *arena, vector<DeparsedStmt *> *deparsed_stmts, string *text, Task *task,
+						   const vector<StmtCode> &stmt_codes, MatchMode matcher, StmtDictionary *dictionary)
+{
+	vector<const string *> codes(stmt_codes.size(), (const string *)NULL);
+	for (size_t i = 0; i < stmt_codes.size(); i++) {
+		if (!stmt_codes.at(i).is_empty) codes.at(i) = &stmt_codes.at(i).code;
+	}
+	vector<size_t> offsets;
+	layout_codes(task->stmts, codes, text, &offsets);
+	StmtIndex index(matcher == MatchByWindow, dictionary);
+	for (size_t i = 0; i < stmt_codes.size(); i++) {
+		const StmtCode &stmt_code = stmt_codes.at(i);
+		if (stmt_code.is_empty) continue;
+		if (stmt_code.is_unique && matcher == MatchByWindow) {
+			/*
+			 * the windows containing a unique statement are unique too, so it separates the
+			 * windows of its block instead of being a record. the repeats and the blocks keep
+			 * it, as it separates them by its unique hash (see find_repeats, add_blocks)
+			 */
+			const Stmt *stmt = task->stmts.at(i);
+			index.open_windows[make_pair(stmt->indent, stmt->block_id)].clear();
+			continue;
+		}
+		add_stmt(arena, deparsed_stmts, task->stmts.at(i), *text, offsets.at(i), stmt_code.code.size(),
+				 stmt_code.hash, &index, stmt_code.is_source);
+	}
+	if (matcher == MatchByWindow) set_parents(arena, deparsed_stmts);
+	if (matcher == MatchByBlock) add_blocks(arena, deparsed_stmts);
+}
+
+static void set_deparsed_stmts(Arena *arena, vector<DeparsedStmt *> *deparsed_stmts, string *text, Task *task,
+							   Deparser *deparser, const map<size_t, string> &file_codes,
+							   const map<size_t, string> *process_codes,
+							   const DeparseCache *cache, DeparseCacheJournal *journal, size_t stmts_size,
+							   MatchMode matcher, StmtDictionary *dictionary)
+{
+	vector<StmtCode> stmt_codes(stmts_size);
+	for (size_t i = 0; i < stmts_size; i++) {
+		deparse_stmt(&stmt_codes.at(i), task, i, deparser, file_codes, process_codes, cache, journal);
+	}
+	add_stmt_codes(arena, deparsed_stmts, text, task, stmt_codes, matcher, dictionary);
+}
+
+/* deparse-free detection: statements are compared by their canonical tokens */
+static void set_normalized_stmts(Arena *arena, vector<DeparsedStmt *> *deparsed_stmts, string *text, Task *task,
+								 const LexicalNormalizer *normalizer, MatchMode matcher,
+								 StmtDictionary *dictionary)
+{
+	vector<string> normalized_codes(task->stmts.size());
+	vector<const string *> codes(task->stmts.size(), (const string *)NULL);
+	for (size_t i = 0; i < task->stmts.size(); i++) {
+		normalized_codes.at(i) = normalizer->normalize(task, task->stmts.at(i));
+		const string &code = normalized_codes.at(i);
+		if (code != "" && code != ";") codes.at(i) = &code;
+	}
+	vector<size_t> offsets;
+	layout_codes(task->stmts, codes, text, &offsets);
+	StmtIndex index(matcher == MatchByWindow, dictionary);
+	for (size_t i = 0; i < task->stmts.size(); i++) {
+		if (!codes.at(i)) continue;
+		add_stmt(arena, deparsed_stmts, task->stmts.at(i), *text, offsets.at(i), codes.at(i)->size(),
+				 "", &index, false);
+	}
+	if (matcher == MatchByWindow) set_parents(arena, deparsed_stmts);
+	if (matcher == MatchByBlock) add_blocks(arena, deparsed_stmts);
+}
+
 typedef struct _ThreadArgs {
 	vector<Task *> tasks;
 	size_t tasks_size;
 	int thread_id;
 	int hop_n;
+	size_t max_process_num; /* larger than hop_n if the event scheduler adapts the processes in flight */
+	DeparseMode mode;
+	bool deparse_file;
+	const DeparseCache *cache;
+	DeparseCacheJournal *journal;
+	ZygoteRegistry *zygotes;
+	bool abstracts_variables;
+	const LexicalNormalizer *normalizer;
+	WorkStealingScheduler *scheduler;
+	Deparser **deparser; /* kept by the worker across the detections */
+	TaskInterpreter **preparer; /* kept like deparser */
+	const vector<string> *preparer_args;
+	const vector<string> *preparer_options;
+	vector<string> *prepare_errors; /* indexed by the task */
+	/* indexed by the task, each element is written by the worker of its item only */
+	vector<map<size_t, string> > *file_codes;
+	vector<vector<StmtCode> > *stmt_codes;
+	vector<vector<DeparsedStmt *> > *task_deparsed_stmts;
+	vector<string> *task_texts; /* the codes of the statements of each task (see layout_codes) */
+	MatchMode matcher;
+	StmtDictionary *dictionary; /* shared by the workers, for the repeats only */
+	Arena *arena; /* of the statements added by the worker in the detection */
 } ThreadArgs;
 
-static vector<DeparsedStmt *> total_deparsed_stmts[MAX_JOB_NUM];
+/* a dead deparse server or process must not kill us by SIGPIPE */
+static void block_sigpipe(void)
+{
+	sigset_t sigpipe;
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+}
+
+static void *run_file_deparse(void *args_)
+{
+	ThreadArgs args = *(ThreadArgs *)args_;
+	block_sigpipe();
+	WorkItem item;
+	while (args.scheduler->next(args.thread_id, &item)) {
+		deparse_file(args.tasks.at(item.task_id), &args.file_codes->at(item.task_id));
+	}
+	return NULL;
+}
+
 static void *run(void *args_)
+{
+	ThreadArgs args = *(ThreadArgs *)args_;
+	block_sigpipe();
+	Deparser *deparser = *args.deparser;
+	if (!deparser && args.mode == DeparseByServer) {
+		deparser = new DeparseServerPool(MAX_SERVER_NUM_PER_THREAD);
+	} else if (!deparser && args.mode == DeparseByInterpreter) {
+		deparser = new DeparseInterpreterPool(MAX_INTERPRETER_NUM_PER_THREAD);
+	} else if (!deparser && args.mode == DeparseByFingerprint) {
+		deparser = new DeparseInterpreterPool(MAX_INTERPRETER_NUM_PER_THREAD, true, args.abstracts_variables);
+	} else if (!deparser && args.mode == DeparseByZygote) {
+		deparser = new ZygoteDeparser(args.zygotes, ZYGOTE_BATCH_SIZE, MAX_ZYGOTE_CHILD_NUM_PER_THREAD);
+	}
+	*args.deparser = deparser;
+	WorkItem item;
+	while (args.scheduler->next(args.thread_id, &item)) {
+		size_t task_id = item.task_id;
+		deparse_stmt(&args.stmt_codes->at(task_id).at(item.stmt_id), args.tasks.at(task_id), item.stmt_id,
+					 deparser, args.file_codes->at(task_id), NULL,
+					 args.cache, args.journal);
+	}
+	return NULL;
+}
+
+static void decode_prepared_task(PerlInterpreter *my_perl, HV *prepared_task, Task *task);
+
+static void *run_prepare(void *args_)
+{
+	ThreadArgs args = *(ThreadArgs *)args_;
+	TaskInterpreter *preparer = *args.preparer;
+	if (!preparer) preparer = new TaskInterpreter(*args.preparer_args, *args.preparer_options);
+	*args.preparer = preparer;
+	WorkItem item;
+	while (args.scheduler->next(args.thread_id, &item)) {
+		Task *task = args.tasks.at(item.task_id);
+		if (task->is_prepared) continue;
+		preparer->prepare(task, decode_prepared_task, &args.prepare_errors->at(item.task_id));
+	}
+	return NULL;
+}
+
+/* embedded interpreters must be destructed by the thread which has used them */
+static void *run_cleanup(void *args_)
+{
+	ThreadArgs args = *(ThreadArgs *)args_;
+	delete *args.deparser;
+	*args.deparser = NULL;
+	delete *args.preparer;
+	*args.preparer = NULL;
+	return NULL;
+}
+
+/* the codes are added file by file, as add_stmt() numbers the statements in the order of the file */
+static void *run_add_stmts(void *args_)
+{
+	ThreadArgs args = *(ThreadArgs *)args_;
+	WorkItem item;
+	while (args.scheduler->next(args.thread_id, &item)) {
+		size_t task_id = item.task_id;
+		vector<DeparsedStmt *> *deparsed_stmts = &args.task_deparsed_stmts->at(task_id);
+		string *text = &args.task_texts->at(task_id);
+		if (args.mode == DeparseByLexer) {
+			set_normalized_stmts(args.arena, deparsed_stmts, text, args.tasks.at(task_id), args.normalizer,
+								 args.matcher, args.dictionary);
+		} else {
+			add_stmt_codes(args.arena, deparsed_stmts, text, args.tasks.at(task_id), args.stmt_codes->at(task_id),
+						   args.matcher, args.dictionary);
+		}
+	}
+	return NULL;
+}
+
+/* runs worker on each thread of the pool with its own ThreadArgs */
+class DetectionRound : public WorkerRound {
+public:
+	vector<ThreadArgs> *args;
+	void *(*worker)(void *);
+	DetectionRound(vector<ThreadArgs> *args_, void *(*worker_)(void *)) : args(args_), worker(worker_) {}
+	void run(size_t worker_id) {
+		if (worker_id < args->size()) worker((void *)&args->at(worker_id));
+	}
+};
+
+static void run_workers(WorkerPool *pool, vector<ThreadArgs> &args, void *(*worker)(void *), const vector<WorkItem> &items)
+{
+	WorkStealingScheduler scheduler(args.size(), items);
+	for (size_t i = 0; i < args.size(); i++) {
+		args[i].scheduler = &scheduler;
+	}
+	DetectionRound round(&args, worker);
+	pool->run(&round);
+}
+
+/*
+ * deparses all the tasks by processes from one thread.
+ * hop_n is the number of the processes in flight, which isn't limited by the number of the threads.
+ */
+static void *run_multiplexed(void *args_)
 {
 	ThreadArgs args = *(ThreadArgs *)args_;
 	vector<Task *> tasks = args.tasks;
-	int thread_id = args.thread_id;
-	int hop_n = args.hop_n;
 	size_t tasks_size = args.tasks_size;
-	size_t tmp_file_name_size = 128;
-	const char *tmp_file_name = (const char *)malloc(tmp_file_name_size);
-	memset((char *)tmp_file_name, 0, tmp_file_name_size);
-	snprintf((char *)tmp_file_name, tmp_file_name_size, "__copy_paste_detector%d.tmp", thread_id);
-	vector<DeparsedStmt *> merged_deparsed_stmts;
-	for (size_t i = thread_id; i <= tasks_size; i += hop_n) {
+	block_sigpipe();
+	ProcessMultiplexer multiplexer(args.hop_n, args.max_process_num);
+	vector<map<size_t, string> > file_codes(tasks_size + 1);
+	if (args.deparse_file) {
+		vector<ProcessRequest *> requests(tasks_size + 1, (ProcessRequest *)NULL);
+		vector<ProcessRequest *> running_requests;
+		for (size_t i = 0; i <= tasks_size; i++) {
+			Task *task = tasks.at(i);
+			if (task->file_argv.empty() || task->stmts.empty()) continue;
+			vector<string> file_argv = task->file_argv;
+			file_argv.push_back(task->filename);
+			requests.at(i) = new ProcessRequest(file_argv, "");
+			running_requests.push_back(requests.at(i));
+		}
+		multiplexer.run(running_requests);
+		for (size_t i = 0; i <= tasks_size; i++) {
+			ProcessRequest *request = requests.at(i);
+			if (!request) continue;
+			/* a file which doesn't compile is deparsed statement by statement */
+			if (request->succeeded) {
+				FileDeparser file_deparser;
+				file_deparser.parse(request->output);
+				file_deparser.assign(tasks.at(i), &file_codes.at(i));
+			}
+			delete request;
+		}
+	}
+	/* the same statement of the same command is deparsed once */
+	map<pair<const DeparseCommand *, string>, size_t> request_indexes;
+	vector<ProcessRequest *> requests;
+	vector<map<size_t, size_t> > stmt_requests(tasks_size + 1);
+	for (size_t i = 0; i <= tasks_size; i++) {
 		Task *task = tasks.at(i);
-		vector<DeparsedStmt *> deparsed_stmts;
-		set_deparsed_stmts(&deparsed_stmts, task, tmp_file_name, task->size());
-		merged_deparsed_stmts.insert(merged_deparsed_stmts.end(),
-									 deparsed_stmts.begin(), deparsed_stmts.end());
+		for (size_t j = 0; j < task->stmts.size(); j++) {
+			Stmt *stmt = task->stmts.at(j);
+			if (file_codes.at(i).count(j) || stmt->is_unique) continue;
+			const DeparseCommand *cmd = (stmt->has_warnings) ? stmt->full_cmd : stmt->normal_cmd;
+			string prefix;
+			const char *src = strip_branch(stmt->src, &prefix);
+			string code;
+			string hash;
+			if (args.cache && args.cache->lookup(DeparseCacheKey(cmd, src), &code, &hash, args.journal)) continue;
+			pair<const DeparseCommand *, string> key(cmd, string(src));
+			map<pair<const DeparseCommand *, string>, size_t>::iterator it = request_indexes.find(key);
+			if (it == request_indexes.end()) {
+				it = request_indexes.insert(make_pair(key, requests.size())).first;
+				requests.push_back(new ProcessRequest(cmd->argv, cmd->stdin_header + src + "\n"));
+			}
+			stmt_requests.at(i).insert(make_pair(j, it->second));
+		}
+	}
+	multiplexer.run(requests);
+	for (size_t i = 0; i <= tasks_size; i++) {
+		map<size_t, string> process_codes;
+		for (map<size_t, size_t>::iterator it = stmt_requests.at(i).begin(); it != stmt_requests.at(i).end(); it++) {
+			process_codes.insert(make_pair(it->first, requests.at(it->second)->output));
+		}
+		set_deparsed_stmts(args.arena, &args.task_deparsed_stmts->at(i), &args.task_texts->at(i), tasks.at(i),
+						   NULL, file_codes.at(i), &process_codes, args.cache, args.journal, tasks.at(i)->stmts.size(),
+						   args.matcher, args.dictionary);
+	}
+	for (size_t i = 0; i < requests.size(); i++) {
+		delete requests.at(i);
 	}
-	/* Lock Free */
-	total_deparsed_stmts[thread_id] = merged_deparsed_stmts;
 	return NULL;
 }
 
-static Stmt *decode_stmt(pTHX_ HV *stmt)
+/* the strings of perl are borrowed, unless the task keeps them as their interpreter goes on */
+static const char *decode_string(pTHX_ SV *sv, Task *owner)
 {
-	char *src = SvPVX(get_value(stmt, "src"));
+	if (!owner) return SvPVX(sv);
+	STRLEN len;
+	const char *data = SvPV(sv, len);
+	return owner->arena.copy(data, len);
+}
+
+static Stmt *decode_stmt(pTHX_ HV *stmt, Task *task, Task *owner)
+{
+	const char *src = decode_string(aTHX_ get_value(stmt, "src"), owner);
 	int token_num = SvIVX(get_value(stmt, "token_num"));
 	int indent = SvIVX(get_value(stmt, "indent"));
 	int block_id = SvIVX(get_value(stmt, "block_id"));
 	int start_line = SvIVX(get_value(stmt, "start_line"));
 	int end_line = SvIVX(get_value(stmt, "end_line"));
 	int has_warnings = SvIVX(get_value(stmt, "has_warnings"));
-	return new Stmt(src, token_num, indent, block_id,
+	void *allocated = task->arena.allocate(sizeof(Stmt));
+	return new (allocated) Stmt(src, token_num, indent, block_id,
 					start_line, end_line, has_warnings);
 }
 
-static void setup_task(pTHX_ Task *decoded_task, HV *task)
+static SV **fetch_command(pTHX_ HV *command, string key)
+{
+	return hv_fetch(command, key.c_str(), key.size(), 0);
+}
+
+static void decode_strings(pTHX_ SV **strings, vector<string> *decoded)
+{
+	if (!strings || !SvROK(*strings)) return;
+	AV *strings_ = (AV *)SvRV(*strings);
+	for (SSize_t i = 0; i <= av_len(strings_); i++) {
+		decoded->push_back(string(SvPV_nolen(*av_fetch(strings_, i, 0))));
+	}
+}
+
+static DeparseCommand *decode_command(pTHX_ HV *command, const char *name, Task *owner)
+{
+	string key = name;
+	const char *process = decode_string(aTHX_ *fetch_command(aTHX_ command, key), owner);
+	DeparseCommand *cmd = new DeparseCommand(process);
+	decode_strings(aTHX_ fetch_command(aTHX_ command, key + "_argv"), &cmd->argv);
+	decode_strings(aTHX_ fetch_command(aTHX_ command, key + "_server_argv"), &cmd->server_argv);
+	decode_strings(aTHX_ fetch_command(aTHX_ command, key + "_zygote_argv"), &cmd->zygote_argv);
+	decode_strings(aTHX_ fetch_command(aTHX_ command, key + "_args"), &cmd->args);
+	SV **stamp = fetch_command(aTHX_ command, key + "_stamp");
+	if (stamp && SvOK(*stamp)) cmd->stamp = SvPV_nolen(*stamp);
+	SV **stdin_header = hv_fetchs(command, "stdin_header", 0);
+	if (stdin_header) cmd->stdin_header = SvPV_nolen(*stdin_header);
+	return cmd;
+}
+
+/* the command of __make_command, given to the task and its statements */
+static void set_command(pTHX_ Task *task, HV *command, Task *owner)
+{
+	DeparseCommand *full_cmd = decode_command(aTHX_ command, "full", owner);
+	DeparseCommand *normal_cmd = decode_command(aTHX_ command, "normal", owner);
+	task->commands.push_back(full_cmd);
+	task->commands.push_back(normal_cmd);
+	decode_strings(aTHX_ hv_fetchs(command, "file_argv", 0), &task->file_argv);
+	for (size_t i = 0; i < task->stmts.size(); i++) {
+		task->stmts.at(i)->full_cmd = full_cmd;
+		task->stmts.at(i)->normal_cmd = normal_cmd;
+	}
+}
+
+/*
+ * owner is the task itself if the strings of task are freed before it.
+ * the task prepared by a worker has no command but its used modules.
+ */
+static void setup_task(pTHX_ Task *decoded_task, HV *task, Task *owner)
 {
-	const char *filename = SvPVX(get_value(task, "filename"));
+	const char *filename = decode_string(aTHX_ get_value(task, "filename"), owner);
 	AV *stmts_ = (AV *)SvRV(get_value(task, "stmts"));
-	HV *command = (HV *)SvPVX(get_value(task, "command"));
-	const char *full_cmd = SvPVX(get_value(command, "full"));
-	const char *normal_cmd = SvPVX(get_value(command, "normal"));
+	decoded_task->filename = filename;
+	decoded_task->is_prepared = true;
+	decode_strings(aTHX_ hv_fetchs(task, "modules", 0), &decoded_task->modules);
+	SV **tokens = hv_fetchs(task, "tokens", 0);
+	if (tokens && SvROK(*tokens)) {
+		AV *tokens_ = (AV *)SvRV(*tokens);
+		for (SSize_t i = 0; i <= av_len(tokens_); i++) {
+			HV *token = (HV *)SvRV(*av_fetch(tokens_, i, 0));
+			int line = SvIV(get_value(token, "line"));
+			decoded_task->token_lines.insert(make_pair(line, decoded_task->tokens.size()));
+			decoded_task->tokens.push_back(SourceToken(SvIV(get_value(token, "type")), line,
+													   SvPV_nolen(get_value(token, "data"))));
+		}
+	}
 	SV **stmts = stmts_->sv_u.svu_array;
 	if (stmts) {
-		size_t stmts_size = av_len(stmts_);
+		/* av_len is the last index */
+		size_t stmts_size = av_len(stmts_) + 1;
 		for (size_t i = 0; i < stmts_size; i++) {
-			Stmt *stmt = decode_stmt(aTHX_ (HV *)SvRV(stmts[i]));
+			Stmt *stmt = decode_stmt(aTHX_ (HV *)SvRV(stmts[i]), decoded_task, owner);
 			stmt->filename = filename;
-			stmt->full_cmd = full_cmd;
-			stmt->normal_cmd = normal_cmd;
-			decoded_task->push_back(stmt);
+			decoded_task->stmts.push_back(stmt);
 		}
 	}
+	SV **command = hv_fetchs(task, "command", 0);
+	if (command && SvROK(*command)) set_command(aTHX_ decoded_task, (HV *)SvRV(*command), owner);
 }
 
-AV *make_return_value(pTHX_ vector<DeparsedStmt *> *deparsed_stmts)
+/* token_classes is the hash of Compiler::Tools::CopyPasteDetector::__token_classes */
+static void decode_token_classes(pTHX_ SV **token_classes, LexicalNormalizer *normalizer)
+{
+	if (!token_classes || !SvROK(*token_classes)) return;
+	HV *classes = (HV *)SvRV(*token_classes);
+	hv_iterinit(classes);
+	HE *entry;
+	while ((entry = hv_iternext(classes))) {
+		I32 len;
+		int type = atoi(hv_iterkey(entry, &len));
+		string name = SvPV_nolen(hv_iterval(classes, entry));
+		TokenClass token_class = TokenOther;
+		if (name == "comment") token_class = TokenComment;
+		else if (name == "string") token_class = TokenString;
+		else if (name == "key") token_class = TokenKey;
+		else if (name == "number") token_class = TokenNumber;
+		else if (name == "quote") token_class = TokenQuote;
+		else if (name == "delim") token_class = TokenDelim;
+		normalizer->classes.insert(make_pair(type, token_class));
+	}
+}
+
+/* the statements of a detection, which live in the arenas of its workers until they are returned to perl */
+class DetectedStmts {
+public:
+	vector<DeparsedStmt *> stmts;
+	vector<Arena *> arenas;
+	vector<string> texts; /* of each task, where the codes of its statements are */
+	~DetectedStmts(void) { release(); }
+	void release(void) {
+		for (size_t i = 0; i < arenas.size(); i++) delete arenas.at(i);
+		arenas.clear();
+		stmts.clear();
+		texts.clear();
+	}
+	void swap(DetectedStmts *another) {
+		stmts.swap(another->stmts);
+		arenas.swap(another->arenas);
+		texts.swap(another->texts);
+	}
+};
+
+/* whether a clone set of lines and token_num is reported by get_score, which calls it too */
+static bool is_reported_size(int lines, int token_num, int min_line_num, int min_token_num)
+{
+	return lines + 1 >= min_line_num && token_num > min_token_num;
+}
+
+/*
+ * replaces the statements by the maximal repeats of their blocks across all the files (see RepeatFinder).
+ * a repeat is a record at each of its occurrences, and it is kept if one of its occurrences is as long
+ * as the reports require (see is_reported_size). a repeat can't be extended, but the repeat of a nested block
+ * has the repeats enclosing it one indent above as its parents, if each of its occurrences is enclosed,
+ * so get_score reports the outer repeat only.
+ * the symbols are the ids given by dictionary, and a statement which occurs once is a separator,
+ * as no repeat can run through it.
+ */
+static void find_repeats(DetectedStmts *deparsed_stmts, const StmtDictionary &dictionary,
+						 int min_token_num, int min_line_num)
+{
+	vector<DeparsedStmt *> stmts = deparsed_stmts->stmts;
+	sort(stmts.begin(), stmts.end(), BlockOrder());
+	vector<uint32_t> counts;
+	dictionary.get_counts(&counts);
+	RepeatFinder finder;
+	/* indexed by the position in finder, NULL at the separators */
+	vector<DeparsedStmt *> sequence;
+	vector<int> token_nums(1, 0); /* of the statements before the position */
+	vector<int> source_nums(1, 0);
+	for (size_t i = 0; i < stmts.size(); i++) {
+		DeparsedStmt *stmt = stmts.at(i);
+		DeparsedStmt *prev_stmt = (i > 0) ? stmts.at(i - 1) : NULL;
+		bool is_unique = (counts.at(stmt->stmt_id) < 2);
+		bool starts_block = (prev_stmt && (prev_stmt->file_id != stmt->file_id ||
+										   prev_stmt->indent != stmt->indent || prev_stmt->block_id != stmt->block_id));
+		if ((is_unique || starts_block) && (sequence.empty() || sequence.back())) {
+			finder.separate();
+			sequence.push_back(NULL);
+			token_nums.push_back(token_nums.back());
+			source_nums.push_back(source_nums.back());
+		}
+		if (is_unique) continue;
+		finder.add(stmt->stmt_id);
+		sequence.push_back(stmt);
+		token_nums.push_back(token_nums.back() + stmt->token_num);
+		source_nums.push_back(source_nums.back() + stmt->is_source);
+	}
+	finder.separate();
+	vector<Repeat> repeats;
+	finder.find(&repeats);
+	Arena *arena = new Arena();
+	deparsed_stmts->arenas.push_back(arena);
+	vector<DeparsedStmt *> repeated_stmts;
+	vector<size_t> repeat_ends; /* of the occurrences of each repeat in repeated_stmts */
+	for (size_t i = 0; i < repeats.size(); i++) {
+		Repeat &repeat = repeats.at(i);
+		size_t length = repeat.length;
+		vector<size_t> &positions = repeat.positions;
+		sort(positions.begin(), positions.end());
+		bool is_reported = false;
+		for (size_t j = 0; j < positions.size() && !is_reported; j++) {
+			int line_num = sequence.at(positions.at(j) + length - 1)->end_line - sequence.at(positions.at(j))->start_line;
+			int token_num = token_nums.at(positions.at(j) + length) - token_nums.at(positions.at(j));
+			is_reported = is_reported_size((line_num > 0) ? line_num : 1, token_num, min_line_num, min_token_num);
+		}
+		if (!is_reported) continue;
+		/* the hash of the windows of add_stmt */
+		StmtHash hash = sequence.at(positions.at(0))->hash;
+		for (size_t j = 1; j < length; j++) {
+			hash = combine(hash, sequence.at(positions.at(0) + j)->hash);
+		}
+		for (size_t j = 0; j < positions.size(); j++) {
+			size_t position = positions.at(j);
+			DeparsedStmt *first = sequence.at(position);
+			DeparsedStmt *last = sequence.at(position + length - 1);
+			int line_num = last->end_line - first->start_line;
+			DeparsedStmt *repeated_stmt = new (arena->allocate(sizeof(DeparsedStmt)))
+				DeparsedStmt(hash, first->text_offset, last->text_offset + last->text_size - first->text_offset,
+							 source_nums.at(position + length) > source_nums.at(position),
+							 (line_num > 0) ? line_num : 1,
+							 first->start_line, last->end_line,
+							 first->indent, first->block_id, last->stmt_num,
+							 token_nums.at(position + length) - token_nums.at(position));
+			repeated_stmt->file_id = first->file_id;
+			for (size_t k = position; k < position + length; k++) {
+				repeated_stmt->has_warnings = repeated_stmt->has_warnings || sequence.at(k)->has_warnings;
+			}
+			repeated_stmts.push_back(repeated_stmt);
+		}
+		repeat_ends.push_back(repeated_stmts.size());
+	}
+	/* file_id => indent => the occurrences by their start lines, as (start_line, index in repeated_stmts) */
+	map<size_t, map<int, vector<pair<int, size_t> > > > starts;
+	for (size_t i = 0; i < repeated_stmts.size(); i++) {
+		DeparsedStmt *stmt = repeated_stmts.at(i);
+		starts[stmt->file_id][stmt->indent].push_back(make_pair(stmt->start_line, i));
+	}
+	/*
+	 * the occurrences one indent above which enclose each occurrence. the repeats may overlap each
+	 * other, so the occurrences above are swept by their starts, and the ones started so far are
+	 * looked up by their ends.
+	 */
+	vector<vector<DeparsedStmt *> > enclosings(repeated_stmts.size());
+	for (map<size_t, map<int, vector<pair<int, size_t> > > >::iterator file = starts.begin(); file != starts.end(); file++) {
+		map<int, vector<pair<int, size_t> > > &indents = file->second;
+		for (map<int, vector<pair<int, size_t> > >::iterator it = indents.begin(); it != indents.end(); it++) {
+			map<int, vector<pair<int, size_t> > >::iterator above = indents.find(it->first - 1);
+			if (above == indents.end()) continue;
+			vector<pair<int, size_t> > &inners = it->second;
+			vector<pair<int, size_t> > &outers = above->second;
+			sort(inners.begin(), inners.end());
+			sort(outers.begin(), outers.end());
+			multimap<int, DeparsedStmt *> started; /* by the end lines */
+			size_t next = 0;
+			for (size_t i = 0; i < inners.size(); i++) {
+				DeparsedStmt *stmt = repeated_stmts.at(inners.at(i).second);
+				for (; next < outers.size() && outers.at(next).first <= stmt->start_line; next++) {
+					DeparsedStmt *outer = repeated_stmts.at(outers.at(next).second);
+					started.insert(make_pair(outer->end_line, outer));
+				}
+				/* the ones ended before this start enclose none of the next ones */
+				started.erase(started.begin(), started.lower_bound(stmt->start_line));
+				vector<DeparsedStmt *> &stmt_enclosings = enclosings.at(inners.at(i).second);
+				for (multimap<int, DeparsedStmt *>::iterator outer = started.lower_bound(stmt->end_line); outer != started.end(); outer++) {
+					stmt_enclosings.push_back(outer->second);
+				}
+			}
+		}
+	}
+	for (size_t i = 0, begin = 0; i < repeat_ends.size(); i++) {
+		size_t end = repeat_ends.at(i);
+		bool is_enclosed = true;
+		for (size_t j = begin; j < end && is_enclosed; j++) {
+			is_enclosed = !enclosings.at(j).empty();
+		}
+		for (size_t j = begin; is_enclosed && j < end; j++) {
+			const vector<DeparsedStmt *> &stmt_enclosings = enclosings.at(j);
+			for (size_t k = 0; k < stmt_enclosings.size(); k++) {
+				repeated_stmts.at(j)->add_parent(arena, &stmt_enclosings.at(k)->hash);
+			}
+		}
+		begin = end;
+	}
+	deparsed_stmts->stmts.swap(repeated_stmts);
+}
+
+/*
+ * the records share one text, whose range is decoded (and base64 encoded) by perl
+ * for the clones which are reported only, and the filename of their task.
+ */
+AV *make_return_value(pTHX_ const vector<Task *> &tasks, DetectedStmts *deparsed_stmts)
 {
 	AV* ret  = new_Array();
-	for (size_t j = 0; j < deparsed_stmts->size(); j++) {
-		DeparsedStmt *stmt = deparsed_stmts->at(j);
+	vector<size_t> text_offsets;
+	size_t text_size = 0;
+	for (size_t i = 0; i < deparsed_stmts->texts.size(); i++) {
+		text_offsets.push_back(text_size);
+		text_size += deparsed_stmts->texts.at(i).size();
+	}
+	SV *text = new_String("", 0);
+	SvGROW(text, text_size + 1);
+	for (size_t i = 0; i < deparsed_stmts->texts.size(); i++) {
+		const string &task_text = deparsed_stmts->texts.at(i);
+		sv_catpvn(text, task_text.data(), task_text.size());
+	}
+	vector<SV *> files;
+	/*
+	 * the commands which deparse the sources of the records of each task like the workers deparse
+	 * their statements, tried in order (see __materialize_src): the full and the normal ones
+	 * for the records with warnings, and the normal one for the others (see setup_task).
+	 */
+	vector<AV *> deparse_argvs;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		files.push_back(new_String(tasks.at(i)->filename, strlen(tasks.at(i)->filename)));
+		const vector<DeparseCommand *> &commands = tasks.at(i)->commands;
+		AV *full_argvs = new_Array();
+		AV *normal_argvs = new_Array();
+		for (size_t j = 0; j < commands.size(); j++) {
+			AV *argv = new_Array();
+			for (size_t k = 0; k < commands.at(j)->argv.size(); k++) {
+				const string &arg = commands.at(j)->argv.at(k);
+				av_push(argv, set(new_String(arg.data(), arg.size())));
+			}
+			av_push(full_argvs, set(new_Ref(argv)));
+			if (j > 0) av_push(normal_argvs, set(new_Ref(argv)));
+		}
+		deparse_argvs.push_back(full_argvs);
+		deparse_argvs.push_back(normal_argvs);
+	}
+	vector<DeparsedStmt *> *stmts = &deparsed_stmts->stmts;
+	for (size_t j = 0; j < stmts->size(); j++) {
+		DeparsedStmt *stmt = stmts->at(j);
 		HV *hash = (HV*)new_Hash();
-		hv_stores(hash, "hash", set(new_String(stmt->hash, strlen(stmt->hash))));
-		hv_stores(hash, "src", set(new_String(stmt->src, strlen(stmt->src))));
-		hv_stores(hash, "orig", set(new_String(stmt->orig, strlen(stmt->orig))));
-		hv_stores(hash, "file", set(new_String(stmt->file, strlen(stmt->file))));
+		hv_stores(hash, "hash", set(new_String((const char *)stmt->hash.bytes, STMT_HASH_SIZE)));
+		hv_stores(hash, "file", newSVsv(files.at(stmt->file_id)));
+		hv_stores(hash, "text", newRV_inc(text));
+		hv_stores(hash, "text_offset", set(new_Int(text_offsets.at(stmt->file_id) + stmt->text_offset)));
+		hv_stores(hash, "text_size", set(new_Int(stmt->text_size)));
+		hv_stores(hash, "is_source", set(new_Int(stmt->is_source)));
+		if (stmt->is_source) {
+			AV *argvs = deparse_argvs.at(stmt->file_id * 2 + ((stmt->has_warnings) ? 0 : 1));
+			hv_stores(hash, "deparse_argvs", newRV_inc((SV *)argvs));
+		}
 		hv_stores(hash, "lines", set(new_Int(stmt->lines)));
 		hv_stores(hash, "start_line", set(new_Int(stmt->start_line)));
 		hv_stores(hash, "end_line", set(new_Int(stmt->end_line)));
@@ -280,9 +1112,8 @@ AV *make_return_value(pTHX_ vector<DeparsedStmt *> *deparsed_stmts)
 		hv_stores(hash, "stmt_num", set(new_Int(stmt->stmt_num)));
 		hv_stores(hash, "token_num", set(new_Int(stmt->token_num)));
 		AV* parents  = new_Array();
-		for (size_t k = 0; k < stmt->parents.size(); k++) {
-			const char *parent_hash = stmt->parents.at(k);
-			av_push(parents, set(new_String(parent_hash, strlen(parent_hash))));
+		for (ParentHash *parent = stmt->parents; parent; parent = parent->next) {
+			av_push(parents, set(new_String((const char *)parent->hash->bytes, STMT_HASH_SIZE)));
 		}
 		hv_stores(hash, "parents", set(new_Ref(parents)));
 		av_push(ret, set(new_Ref(hash)));
@@ -290,43 +1121,751 @@ AV *make_return_value(pTHX_ vector<DeparsedStmt *> *deparsed_stmts)
 	return (AV *)new_Ref(ret);
 }
 
-MODULE = Compiler::Tools::CopyPasteDetector		PACKAGE = Compiler::Tools::CopyPasteDetector
-PROTOTYPES: DISABLE
+/*
+ * The state of the detections: the options, the cache and the zygotes live as
+ * long as the engine, so an engine runs many detections and engines run in
+ * parallel without sharing anything. A detection waits for the one running
+ * on the same engine.
+ */
+class DetectorEngine {
+public:
+	size_t job;
+	DeparseMode mode;
+	bool deparse_file;
+	bool multiplexes;
+	bool abstracts_variables;
+	bool adapts;
+	LexicalNormalizer *normalizer;
+	DeparseCache *cache;
+	size_t cache_hit_num; /* of the statements found in the cache by the detections so far */
+	ZygoteRegistry *zygotes;
+	LexicalPrefilter *prefilter;
+	bool has_bucket_sizes; /* counted ahead of the windows of a streamed detection */
+	map<string, Task *> prepared_tasks; /* by the filename, prepared ahead of their detection */
+	MatchMode matcher; /* the records are all the windows, the maximal repeats or the blocks of the statements */
+	int min_token_num; /* of a repeat */
+	int min_line_num;
+	WorkerPool *pool; /* started by the first detection */
+	vector<Deparser *> deparsers; /* of each worker */
+	vector<TaskInterpreter *> preparers; /* of each worker */
+	vector<string> preparer_args; /* -I switches of the perl which has created the engine */
+	vector<string> preparer_options; /* deparser, prefilter and ignore_variable_name */
+	string signature; /* of the options of the detector which has created the engine */
+	pthread_mutex_t mutex;
+	/* the detection running in the background between submit() and collect() */
+	pthread_t detection;
+	bool is_detecting;
+	vector<Task *> detecting_tasks;
+	DetectedStmts detected_stmts;
+	string detection_error;
+	DetectorEngine(size_t job_);
+	~DetectorEngine(void);
+	/* returns false with the error of the file which couldn't be prepared */
+	bool detect(const vector<Task *> &tasks, DetectedStmts *deparsed_stmts, string *error);
+	/*
+	 * lexes the files and keeps them until they are submitted. the engine owns
+	 * the tasks, which are replaced by the ones kept already.
+	 */
+	bool prepare_ahead(vector<Task *> *tasks, string *error);
+	bool count_buckets(vector<Task *> *tasks, string *error);
+	/* drops the counted buckets and the files prepared ahead */
+	void clear_prepared(void);
+	/* replaces the tasks of the files prepared ahead by them */
+	void take_prepared(vector<Task *> *tasks);
+	/* returns false if a detection is still in flight. the engine owns the tasks */
+	bool submit(const vector<Task *> &tasks);
+	/* waits for the submitted detection and hands over its tasks and statements */
+	bool collect(vector<Task *> *tasks, DetectedStmts *deparsed_stmts, string *error);
+private:
+	static void *run_detection(void *engine);
+	void start_pool(void);
+	bool prepare(const vector<Task *> &tasks, string *error);
+	bool keep_prepared(vector<Task *> *tasks, string *error);
+};
 
-AV *
-get_deparsed_stmts_by_xs_parallel(tasks_, job)
-    AV *tasks_
-	size_t job
-CODE:
+DetectorEngine::DetectorEngine(size_t job_) :
+	job((job_ > 0) ? job_ : 1), mode(DeparseByProcess), deparse_file(false), multiplexes(false),
+	abstracts_variables(false), adapts(false),
+	normalizer(NULL), cache(NULL), cache_hit_num(0), zygotes(NULL), prefilter(NULL), has_bucket_sizes(false),
+	matcher(MatchByWindow), min_token_num(0), min_line_num(0), pool(NULL),
+	is_detecting(false)
 {
-	size_t tasks_size = av_len(tasks_);
-	SV **tasks = tasks_->sv_u.svu_array;
-	if (!tasks) RETVAL = (AV *)new_Ref(new_Array());
-	vector<Task *> decoded_tasks;
-	for (size_t i = 0; i <= tasks_size; i++) {
-		HV *task = (HV *)SvRV(tasks[i]);
-		decoded_tasks.push_back(new Task());
-		setup_task(aTHX_ decoded_tasks.at(i), task);
+	pthread_mutex_init(&mutex, NULL);
+}
+
+DetectorEngine::~DetectorEngine(void)
+{
+	if (is_detecting) {
+		vector<Task *> tasks;
+		DetectedStmts deparsed_stmts;
+		string error;
+		collect(&tasks, &deparsed_stmts, &error);
+		for (size_t i = 0; i < tasks.size(); i++) {
+			delete tasks.at(i);
+		}
+	}
+	if (pool) {
+		vector<ThreadArgs> args(deparsers.size());
+		for (size_t i = 0; i < args.size(); i++) {
+			args[i].deparser = &deparsers.at(i);
+			args[i].preparer = &preparers.at(i);
+		}
+		DetectionRound round(&args, run_cleanup);
+		pool->run(&round);
+		delete pool;
+	}
+	clear_prepared();
+	delete zygotes;
+	delete prefilter;
+	delete normalizer;
+	delete cache;
+	pthread_mutex_destroy(&mutex);
+}
+
+/*
+ * the event scheduler runs on one of the workers, which all prepare the files.
+ * a single job runs in the thread of the detection, without a worker thread.
+ */
+void DetectorEngine::start_pool(void)
+{
+	if (pool) return;
+	pool = new WorkerPool((job > 1) ? job : 0);
+	deparsers.resize((pool->worker_num > 0) ? pool->worker_num : 1, (Deparser *)NULL);
+	preparers.resize(deparsers.size(), (TaskInterpreter *)NULL);
+}
+
+/* files are read, lexed and grouped into statements by the workers, larger ones first */
+bool DetectorEngine::prepare(const vector<Task *> &tasks, string *error)
+{
+	vector<WorkItem> items;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (tasks.at(i)->is_prepared) continue;
+		struct stat file_stat;
+		size_t file_size = (stat(tasks.at(i)->filename, &file_stat) == 0) ? file_stat.st_size : 0;
+		items.push_back(WorkItem(i, WHOLE_TASK, file_size));
+	}
+	if (items.empty()) return true;
+	start_pool();
+	vector<string> prepare_errors(tasks.size());
+	vector<ThreadArgs> args(preparers.size());
+	for (size_t i = 0; i < args.size(); i++) {
+		args[i].tasks = tasks;
+		args[i].thread_id = i;
+		args[i].preparer = &preparers.at(i);
+		args[i].preparer_args = &preparer_args;
+		args[i].preparer_options = &preparer_options;
+		args[i].prepare_errors = &prepare_errors;
+	}
+	run_workers(pool, args, run_prepare, items);
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (prepare_errors.at(i).empty()) continue;
+		*error = prepare_errors.at(i);
+		return false;
+	}
+	return true;
+}
+
+bool DetectorEngine::detect(const vector<Task *> &tasks, DetectedStmts *deparsed_stmts, string *error)
+{
+	if (tasks.empty()) return true;
+	pthread_mutex_lock(&mutex);
+	if (!prepare(tasks, error)) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (!tasks.at(i)->commands.empty()) continue;
+		*error = string("no command is given for ") + tasks.at(i)->filename;
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	size_t tasks_size = tasks.size() - 1;
+	if (prefilter) {
+		/* a detection of its own is unique by its own statements */
+		if (!has_bucket_sizes) prefilter->count(tasks);
+		prefilter->mark_unique_stmts(tasks);
+		if (!has_bucket_sizes) prefilter->bucket_sizes.clear();
 	}
+	/* job is the number of the processes in flight for the event scheduler */
 	size_t hop_n = job;
-	pthread_t th[job];
-	ThreadArgs args[job];
-	for (size_t i = 0; i < job; i++) {
-		args[i].tasks = decoded_tasks;
+	start_pool();
+	size_t thread_num = (multiplexes) ? 1 : deparsers.size();
+	vector<map<size_t, string> > file_codes(tasks_size + 1);
+	vector<vector<StmtCode> > stmt_codes(tasks_size + 1);
+	vector<vector<DeparsedStmt *> > task_deparsed_stmts(tasks_size + 1);
+	deparsed_stmts->texts.resize(tasks_size + 1);
+	StmtDictionary dictionary;
+	vector<ThreadArgs> args(thread_num);
+	for (size_t i = 0; i < thread_num; i++) {
+		args[i].tasks = tasks;
 		args[i].thread_id = i;
 		args[i].hop_n = hop_n;
+		/* the processes in flight may climb up to twice the CPUs */
+		args[i].max_process_num = (adapts) ? hop_n * 2 : hop_n;
 		args[i].tasks_size = tasks_size;
-		pthread_create(&th[i], NULL, run, (void *)&args[i]);
+		args[i].mode = mode;
+		args[i].deparse_file = deparse_file;
+		args[i].cache = cache;
+		args[i].journal = (cache) ? new DeparseCacheJournal() : NULL;
+		args[i].zygotes = zygotes;
+		args[i].abstracts_variables = abstracts_variables;
+		args[i].normalizer = normalizer;
+		args[i].scheduler = NULL;
+		args[i].deparser = &deparsers.at(i);
+		args[i].file_codes = &file_codes;
+		args[i].stmt_codes = &stmt_codes;
+		args[i].task_deparsed_stmts = &task_deparsed_stmts;
+		args[i].task_texts = &deparsed_stmts->texts;
+		args[i].matcher = matcher;
+		args[i].dictionary = (matcher == MatchBySuffixArray) ? &dictionary : NULL;
+		args[i].arena = new Arena();
+		deparsed_stmts->arenas.push_back(args[i].arena);
+	}
+	if (multiplexes) {
+		DetectionRound round(&args, run_multiplexed);
+		pool->run(&round);
+	} else {
+		/* files are scheduled by their statements, and statements by their tokens */
+		vector<WorkItem> task_items;
+		for (size_t i = 0; i <= tasks_size; i++) {
+			task_items.push_back(WorkItem(i, WHOLE_TASK, tasks.at(i)->stmts.size()));
+		}
+		if (deparse_file) run_workers(pool, args, run_file_deparse, task_items);
+		if (mode != DeparseByLexer) {
+			vector<WorkItem> stmt_items;
+			for (size_t i = 0; i <= tasks_size; i++) {
+				Task *task = tasks.at(i);
+				stmt_codes.at(i).resize(task->stmts.size());
+				for (size_t j = 0; j < task->stmts.size(); j++) {
+					Stmt *stmt = task->stmts.at(j);
+					bool is_deparsed = (file_codes.at(i).count(j) || stmt->is_unique);
+					stmt_items.push_back(WorkItem(i, j, (is_deparsed) ? 0 : stmt->token_num));
+				}
+			}
+			run_workers(pool, args, run, stmt_items);
+		}
+		run_workers(pool, args, run_add_stmts, task_items);
+	}
+	if (cache) {
+		vector<DeparseCacheJournal *> journals;
+		for (size_t i = 0; i < thread_num; i++) {
+			journals.push_back(args[i].journal);
+			cache_hit_num += args[i].journal->hit_num;
+		}
+		cache->commit(journals);
+		for (size_t i = 0; i < thread_num; i++) {
+			delete args[i].journal;
+		}
+	}
+	for (size_t i = 0; i < task_deparsed_stmts.size(); i++) {
+		for (size_t j = 0; j < task_deparsed_stmts.at(i).size(); j++) {
+			task_deparsed_stmts.at(i).at(j)->file_id = i;
+		}
+		deparsed_stmts->stmts.insert(deparsed_stmts->stmts.end(),
+									 task_deparsed_stmts.at(i).begin(), task_deparsed_stmts.at(i).end());
+	}
+	if (matcher == MatchBySuffixArray) find_repeats(deparsed_stmts, dictionary, min_token_num, min_line_num);
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+/* the tasks given by their filenames only are prepared once, and their detection takes them over */
+bool DetectorEngine::keep_prepared(vector<Task *> *tasks, string *error)
+{
+	for (size_t i = 0; i < tasks->size(); i++) {
+		Task *task = tasks->at(i);
+		if (task->is_prepared) continue;
+		map<string, Task *>::iterator kept = prepared_tasks.find(task->filename);
+		if (kept == prepared_tasks.end()) continue;
+		tasks->at(i) = kept->second;
+		delete task;
+	}
+	bool is_prepared = prepare(*tasks, error);
+	for (size_t i = 0; i < tasks->size(); i++) {
+		Task *task = tasks->at(i);
+		if (!task->is_prepared || !task->filename) {
+			delete task;
+			tasks->at(i) = NULL;
+			continue;
+		}
+		map<string, Task *>::iterator kept = prepared_tasks.insert(make_pair(string(task->filename), task)).first;
+		/* a file given twice is kept once */
+		if (kept->second != task) {
+			delete task;
+			tasks->at(i) = kept->second;
+		}
+	}
+	return is_prepared;
+}
+
+bool DetectorEngine::prepare_ahead(vector<Task *> *tasks, string *error)
+{
+	pthread_mutex_lock(&mutex);
+	bool is_prepared = keep_prepared(tasks, error);
+	pthread_mutex_unlock(&mutex);
+	return is_prepared;
+}
+
+bool DetectorEngine::count_buckets(vector<Task *> *tasks, string *error)
+{
+	pthread_mutex_lock(&mutex);
+	bool is_prepared = keep_prepared(tasks, error);
+	if (prefilter && is_prepared) {
+		prefilter->count(*tasks);
+		has_bucket_sizes = true;
+	}
+	pthread_mutex_unlock(&mutex);
+	return is_prepared;
+}
+
+void DetectorEngine::clear_prepared(void)
+{
+	pthread_mutex_lock(&mutex);
+	if (prefilter) prefilter->bucket_sizes.clear();
+	has_bucket_sizes = false;
+	for (map<string, Task *>::iterator it = prepared_tasks.begin(); it != prepared_tasks.end(); it++) {
+		delete it->second;
+	}
+	prepared_tasks.clear();
+	pthread_mutex_unlock(&mutex);
+}
+
+void DetectorEngine::take_prepared(vector<Task *> *tasks)
+{
+	pthread_mutex_lock(&mutex);
+	for (size_t i = 0; i < tasks->size(); i++) {
+		Task *task = tasks->at(i);
+		if (task->is_prepared) continue;
+		map<string, Task *>::iterator kept = prepared_tasks.find(task->filename);
+		if (kept == prepared_tasks.end()) continue;
+		tasks->at(i) = kept->second;
+		prepared_tasks.erase(kept);
+		delete task;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void *DetectorEngine::run_detection(void *engine_)
+{
+	DetectorEngine *engine = (DetectorEngine *)engine_;
+	engine->detect(engine->detecting_tasks, &engine->detected_stmts, &engine->detection_error);
+	return NULL;
+}
+
+bool DetectorEngine::submit(const vector<Task *> &tasks)
+{
+	if (is_detecting) return false;
+	detecting_tasks = tasks;
+	detected_stmts.release();
+	detection_error.clear();
+	is_detecting = true;
+	/* the detection runs in the caller if no thread can be started */
+	if (pthread_create(&detection, NULL, run_detection, (void *)this) != 0) {
+		is_detecting = false;
+		detect(detecting_tasks, &detected_stmts, &detection_error);
+	}
+	return true;
+}
+
+bool DetectorEngine::collect(vector<Task *> *tasks, DetectedStmts *deparsed_stmts, string *error)
+{
+	if (is_detecting) {
+		pthread_join(detection, NULL);
+		is_detecting = false;
+	}
+	tasks->swap(detecting_tasks);
+	deparsed_stmts->swap(&detected_stmts);
+	detecting_tasks.clear();
+	detected_stmts.release();
+	error->swap(detection_error);
+	detection_error.clear();
+	return error->empty();
+}
+
+static DetectorEngine *new_engine(pTHX_ size_t job, HV *options)
+{
+	DetectorEngine *engine = new DetectorEngine(job);
+	if (!options) return engine;
+	SV **deparser = hv_fetchs(options, "deparser", 0);
+	string deparser_name = (deparser && SvOK(*deparser)) ? SvPV_nolen(*deparser) : "";
+	if (deparser_name == "server") {
+		engine->mode = DeparseByServer;
+	} else if (deparser_name == "embedded") {
+		engine->mode = DeparseByInterpreter;
+	} else if (deparser_name == "zygote") {
+		engine->mode = DeparseByZygote;
+	} else if (deparser_name == "fingerprint") {
+		engine->mode = DeparseByFingerprint;
+	} else if (deparser_name == "lexical") {
+		engine->mode = DeparseByLexer;
+	}
+	DeparseMode mode = engine->mode;
+	SV **ignore_variable_name = hv_fetchs(options, "ignore_variable_name", 0);
+	engine->abstracts_variables = (ignore_variable_name && SvTRUE(*ignore_variable_name));
+	SV **deparse_unit = hv_fetchs(options, "deparse_unit", 0);
+	engine->deparse_file = (deparse_unit && SvOK(*deparse_unit) && string(SvPV_nolen(*deparse_unit)) == "file");
+	SV **scheduler = hv_fetchs(options, "scheduler", 0);
+	/* the event scheduler drives the processes only, other deparsers run on the threads */
+	engine->multiplexes = (mode == DeparseByProcess && scheduler && SvOK(*scheduler) &&
+						   string(SvPV_nolen(*scheduler)) == "event");
+	SV **matcher = hv_fetchs(options, "matcher", 0);
+	string matcher_name = (matcher && SvOK(*matcher)) ? SvPV_nolen(*matcher) : "";
+	if (matcher_name == "suffix_array") {
+		engine->matcher = MatchBySuffixArray;
+	} else if (matcher_name == "block") {
+		engine->matcher = MatchByBlock;
+	}
+	SV **min_token_num = hv_fetchs(options, "min_token_num", 0);
+	SV **min_line_num = hv_fetchs(options, "min_line_num", 0);
+	if (min_token_num && SvOK(*min_token_num)) engine->min_token_num = SvIV(*min_token_num);
+	if (min_line_num && SvOK(*min_line_num)) engine->min_line_num = SvIV(*min_line_num);
+	SV **adaptive = hv_fetchs(options, "adaptive", 0);
+	engine->adapts = (adaptive && SvTRUE(*adaptive));
+	SV **cache_dir = hv_fetchs(options, "cache_dir", 0);
+	SV **cache_size = hv_fetchs(options, "cache_size", 0);
+	/* the cache and the whole-file deparse keep codes, which fingerprints and tokens don't need */
+	bool deparses = (mode != DeparseByFingerprint && mode != DeparseByLexer);
+	if (!deparses) engine->deparse_file = false;
+	SV **prefilter = hv_fetchs(options, "prefilter", 0);
+	bool prefilters = (mode != DeparseByLexer && prefilter && SvTRUE(*prefilter));
+	if (mode == DeparseByLexer || prefilters) {
+		SV **ignore_literal = hv_fetchs(options, "ignore_literal", 0);
+		engine->normalizer = new LexicalNormalizer(ignore_literal && SvTRUE(*ignore_literal));
+		decode_token_classes(aTHX_ hv_fetchs(options, "token_classes", 0), engine->normalizer);
+	}
+	if (prefilters) engine->prefilter = new LexicalPrefilter(engine->normalizer);
+	if (cache_dir && SvOK(*cache_dir) && deparses) {
+		engine->cache = new DeparseCache(SvPV_nolen(*cache_dir),
+										 (cache_size && SvOK(*cache_size)) ? SvUV(*cache_size) : DEFAULT_CACHE_SIZE);
+	}
+	if (mode == DeparseByZygote) engine->zygotes = new ZygoteRegistry(engine->job * MAX_ZYGOTE_CHILD_NUM_PER_THREAD);
+	decode_strings(aTHX_ hv_fetchs(options, "include_args", 0), &engine->preparer_args);
+	engine->preparer_options.push_back((deparser_name.empty()) ? "process" : deparser_name);
+	engine->preparer_options.push_back((prefilters) ? "1" : "0");
+	engine->preparer_options.push_back((engine->abstracts_variables) ? "1" : "0");
+	SV **signature = hv_fetchs(options, "signature", 0);
+	if (signature && SvOK(*signature)) {
+		STRLEN len;
+		const char *bytes = SvPV(*signature, len);
+		engine->signature.assign(bytes, len);
+	}
+	return engine;
+}
+
+/* a task is the hash of __prepare_task, or the filename to be prepared by the workers */
+static void decode_tasks(pTHX_ AV *tasks_, vector<Task *> *decoded_tasks)
+{
+	SV **tasks = tasks_->sv_u.svu_array;
+	if (!tasks) return;
+	for (SSize_t i = 0; i <= av_len(tasks_); i++) {
+		decoded_tasks->push_back(new Task());
+		if (SvROK(tasks[i])) {
+			setup_task(aTHX_ decoded_tasks->back(), (HV *)SvRV(tasks[i]), NULL);
+		} else {
+			decoded_tasks->back()->filename = SvPV_nolen(tasks[i]);
+			decoded_tasks->back()->is_prepared = false;
+		}
+	}
+}
+
+/* called by TaskInterpreter in the context of its interpreter */
+static void decode_prepared_task(PerlInterpreter *my_perl, HV *prepared_task, Task *task)
+{
+	setup_task(aTHX_ task, prepared_task, task);
+}
+
+static void free_tasks(vector<Task *> *tasks)
+{
+	for (size_t i = 0; i < tasks->size(); i++) {
+		delete tasks->at(i);
+	}
+	tasks->clear();
+}
+
+/* makes the error of a detection, which is croaked after the C++ objects are freed */
+static SV *new_error(pTHX_ const string &error)
+{
+	return sv_2mortal(newSVpv(error.c_str(), error.size()));
+}
+
+/*
+ * the tasks and the statements are freed once they are returned to perl.
+ * returns NULL with the error if the detection has failed.
+ */
+static AV *return_deparsed_stmts(pTHX_ vector<Task *> *tasks, DetectedStmts *deparsed_stmts,
+								 const string &error, SV **error_)
+{
+	AV *ret = (error.empty()) ? make_return_value(aTHX_ *tasks, deparsed_stmts) : NULL;
+	if (!ret) *error_ = new_error(aTHX_ error);
+	deparsed_stmts->release();
+	free_tasks(tasks);
+	return ret;
+}
+
+/* returns the used modules of each file, whose task the engine keeps for its detection */
+static AV *prepare_tasks(pTHX_ DetectorEngine *engine, AV *tasks_, SV **error_)
+{
+	vector<Task *> decoded_tasks;
+	decode_tasks(aTHX_ tasks_, &decoded_tasks);
+	string error;
+	if (!engine->prepare_ahead(&decoded_tasks, &error)) {
+		*error_ = new_error(aTHX_ error);
+		return NULL;
+	}
+	AV *ret = new_Array();
+	for (size_t i = 0; i < decoded_tasks.size(); i++) {
+		AV *modules = newAV();
+		const Task *task = decoded_tasks.at(i);
+		const vector<string> &names = task->modules;
+		for (size_t j = 0; j < names.size(); j++) {
+			av_push(modules, newSVpvn(names.at(j).c_str(), names.at(j).size()));
+		}
+		av_push(ret, newRV_noinc((SV *)modules));
+	}
+	return ret;
+}
+
+static bool count_tasks(pTHX_ DetectorEngine *engine, AV *tasks_, SV **error_)
+{
+	vector<Task *> decoded_tasks;
+	decode_tasks(aTHX_ tasks_, &decoded_tasks);
+	string error;
+	/* the engine keeps the tasks for their detection */
+	bool is_counted = engine->count_buckets(&decoded_tasks, &error);
+	if (!is_counted) *error_ = new_error(aTHX_ error);
+	return is_counted;
+}
+
+/* commands_ are the commands of __make_command for the tasks prepared ahead, in the same order */
+static void submit_tasks(pTHX_ DetectorEngine *engine, AV *tasks_, AV *commands_)
+{
+	vector<Task *> decoded_tasks;
+	decode_tasks(aTHX_ tasks_, &decoded_tasks);
+	engine->take_prepared(&decoded_tasks);
+	for (size_t i = 0; commands_ && i < decoded_tasks.size(); i++) {
+		Task *task = decoded_tasks.at(i);
+		SV **command = av_fetch(commands_, i, 0);
+		if (!task->commands.empty() || !command || !SvROK(*command)) continue;
+		set_command(aTHX_ task, (HV *)SvRV(*command), task);
 	}
-	for (size_t i = 0; i < job; i++) {
-		pthread_join(th[i], NULL);
+	engine->submit(decoded_tasks);
+}
+
+static AV *collect_tasks(pTHX_ DetectorEngine *engine, SV **error_)
+{
+	vector<Task *> tasks;
+	DetectedStmts deparsed_stmts;
+	string error;
+	engine->collect(&tasks, &deparsed_stmts, &error);
+	return return_deparsed_stmts(aTHX_ &tasks, &deparsed_stmts, error, error_);
+}
+
+static AV *deparse_tasks(pTHX_ DetectorEngine *engine, AV *tasks_, SV **error_)
+{
+	if (engine->is_detecting) {
+		*error_ = new_error(aTHX_ "a detection is already submitted to the engine");
+		return NULL;
 	}
-	vector<DeparsedStmt *> merged_deparsed_stmts;
-	for (size_t i = 0; i < job; i++) {
-		merged_deparsed_stmts.insert(merged_deparsed_stmts.end(),
-									 total_deparsed_stmts[i].begin(), total_deparsed_stmts[i].end());
+	vector<Task *> decoded_tasks;
+	decode_tasks(aTHX_ tasks_, &decoded_tasks);
+	/* the detection runs off the thread of perl, whose signals and interpreter are left as they are */
+	engine->submit(decoded_tasks);
+	return collect_tasks(aTHX_ engine, error_);
+}
+
+MODULE = Compiler::Tools::CopyPasteDetector		PACKAGE = Compiler::Tools::CopyPasteDetector
+PROTOTYPES: DISABLE
+
+size_t
+get_available_cpu_num()
+CODE:
+{
+	RETVAL = available_cpu_num();
+}
+OUTPUT:
+    RETVAL
+
+bool
+is_reported_size(lines, token_num, min_line_num, min_token_num)
+	int lines
+	int token_num
+	int min_line_num
+	int min_token_num
+
+AV *
+get_deparsed_stmts_by_xs_parallel(tasks_, job, options = NULL)
+    AV *tasks_
+	size_t job
+	HV *options
+CODE:
+{
+	DetectorEngine *engine = new_engine(aTHX_ job, options);
+	SV *error = NULL;
+	RETVAL = deparse_tasks(aTHX_ engine, tasks_, &error);
+	delete engine;
+	if (!RETVAL) croak_sv(error);
+}
+OUTPUT:
+    RETVAL
+
+AV *
+get_maximal_repeats_by_xs(symbols_)
+    AV *symbols_
+CODE:
+{
+	/* [[length, [positions]], ...] of the symbols, where a negative symbol is a separator */
+	RepeatFinder finder;
+	for (SSize_t i = 0; i <= av_len(symbols_); i++) {
+		SV **symbol = av_fetch(symbols_, i, 0);
+		if (symbol && SvOK(*symbol) && SvIV(*symbol) >= 0) finder.add((int)SvIV(*symbol));
+		else finder.separate();
 	}
-	RETVAL = make_return_value(aTHX_ &merged_deparsed_stmts);
+	vector<Repeat> repeats;
+	finder.find(&repeats);
+	RETVAL = new_Array();
+	for (size_t i = 0; i < repeats.size(); i++) {
+		AV *repeat = new_Array();
+		AV *positions = new_Array();
+		vector<size_t> &repeat_positions = repeats[i].positions;
+		sort(repeat_positions.begin(), repeat_positions.end());
+		for (size_t j = 0; j < repeat_positions.size(); j++) {
+			av_push(positions, set(new_Int(repeat_positions[j])));
+		}
+		av_push(repeat, set(new_Int(repeats[i].length)));
+		av_push(repeat, set(new_Ref(positions)));
+		av_push(RETVAL, set(new_Ref(repeat)));
+	}
+}
+OUTPUT:
+    RETVAL
+
+MODULE = Compiler::Tools::CopyPasteDetector		PACKAGE = Compiler::Tools::CopyPasteDetector::Engine
+PROTOTYPES: DISABLE
+
+SV *
+new(klass, job, options = NULL)
+	const char *klass
+	size_t job
+	HV *options
+CODE:
+{
+	DetectorEngine *engine = new_engine(aTHX_ job, options);
+	RETVAL = sv_setref_pv(newSV(0), klass, (void *)engine);
+}
+OUTPUT:
+    RETVAL
+
+AV *
+get_deparsed_stmts(self, tasks_)
+	SV *self
+	AV *tasks_
+CODE:
+{
+	DetectorEngine *engine = INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+	SV *error = NULL;
+	RETVAL = deparse_tasks(aTHX_ engine, tasks_, &error);
+	if (!RETVAL) croak_sv(error);
+}
+OUTPUT:
+    RETVAL
+
+AV *
+prepare(self, tasks_)
+	SV *self
+	AV *tasks_
+CODE:
+{
+	DetectorEngine *engine = INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+	if (engine->is_detecting) croak("a detection is already submitted to the engine");
+	SV *error = NULL;
+	RETVAL = prepare_tasks(aTHX_ engine, tasks_, &error);
+	if (!RETVAL) croak_sv(error);
+}
+OUTPUT:
+    RETVAL
+
+void
+count_buckets(self, tasks_)
+	SV *self
+	AV *tasks_
+CODE:
+{
+	DetectorEngine *engine = INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+	SV *error = NULL;
+	if (!count_tasks(aTHX_ engine, tasks_, &error)) croak_sv(error);
+}
+
+SV *
+signature(self)
+	SV *self
+CODE:
+{
+	DetectorEngine *engine = INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+	RETVAL = newSVpvn(engine->signature.c_str(), engine->signature.size());
+}
+OUTPUT:
+    RETVAL
+
+size_t
+cache_hit_num(self)
+	SV *self
+CODE:
+{
+	DetectorEngine *engine = INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+	RETVAL = engine->cache_hit_num;
+}
+OUTPUT:
+    RETVAL
+
+void
+clear_prepared(self)
+	SV *self
+CODE:
+{
+	DetectorEngine *engine = INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+	engine->clear_prepared();
+}
+
+void
+submit(self, tasks_, commands_ = NULL)
+	SV *self
+	AV *tasks_
+	AV *commands_
+CODE:
+{
+	DetectorEngine *engine = INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+	if (engine->is_detecting) croak("a detection is already submitted to the engine");
+	/* the statements and the filenames are borrowed from perl, so tasks_ must be kept until collect */
+	submit_tasks(aTHX_ engine, tasks_, commands_);
+}
+
+AV *
+collect(self)
+	SV *self
+CODE:
+{
+	DetectorEngine *engine = INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+	SV *error = NULL;
+	RETVAL = collect_tasks(aTHX_ engine, &error);
+	if (!RETVAL) croak_sv(error);
+}
+OUTPUT:
+    RETVAL
+
+void
+DESTROY(self)
+	SV *self
+CODE:
+{
+	delete INT2PTR(DetectorEngine *, SvIV(SvRV(self)));
+}
+
+int
+CLONE_SKIP(...)
+CODE:
+{
+	/* a thread of perl creates its own engine, as the handle can't be shared */
+	RETVAL = 1;
 }
 OUTPUT:
     RETVAL
@@ -0,0 +1,44 @@
+#include <cpd/arena.hpp>
+#include <string.h>
+
+#define ARENA_ALIGNMENT sizeof(double)
+
+using namespace std;
+
+Arena::Arena(size_t chunk_size_) :
+	chunk_size(chunk_size_), current(NULL), left(0) {}
+
+Arena::~Arena(void)
+{
+	for (size_t i = 0; i < chunks.size(); i++) {
+		delete[] chunks.at(i);
+	}
+}
+
+void *Arena::allocate(size_t size)
+{
+	size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+	if (size > left) {
+		/* a large record gets a chunk of its own, so the free space of the last one is kept */
+		if (size > chunk_size / 4) {
+			char *chunk = new char[size];
+			chunks.push_back(chunk);
+			return chunk;
+		}
+		current = new char[chunk_size];
+		left = chunk_size;
+		chunks.push_back(current);
+	}
+	void *ret = current;
+	current += size;
+	left -= size;
+	return ret;
+}
+
+const char *Arena::copy(const char *data, size_t size)
+{
+	char *ret = (char *)allocate(size + 1);
+	memcpy(ret, data, size);
+	ret[size] = '\0';
+	return ret;
+}
@@ -0,0 +1,115 @@
+#include <cpd/cpu_quota.hpp>
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define NO_QUOTA -1.0
+
+using namespace std;
+
+static bool read_line(const string &path, string *line)
+{
+	ifstream file(path.c_str());
+	return file && getline(file, *line);
+}
+
+/* the lines of /proc/self/cgroup are hierarchy-ID:controller-list:cgroup-path */
+static bool find_cgroup(const string &controller, string *path)
+{
+	ifstream file("/proc/self/cgroup");
+	string line;
+	while (file && getline(file, line)) {
+		size_t first = line.find(':');
+		size_t second = (first == string::npos) ? string::npos : line.find(':', first + 1);
+		if (second == string::npos) continue;
+		string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+		if ((controller.empty() && controllers == ",,") ||
+			(!controller.empty() && controllers.find("," + controller + ",") != string::npos)) {
+			*path = line.substr(second + 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* cpu.max is "max <period>" or "<quota> <period>" */
+static double cgroup2_quota(const string &dir)
+{
+	string line;
+	if (!read_line(dir + "/cpu.max", &line)) return NO_QUOTA;
+	istringstream fields(line);
+	string quota;
+	double period = 0;
+	if (!(fields >> quota >> period) || quota == "max" || period <= 0) return NO_QUOTA;
+	return atof(quota.c_str()) / period;
+}
+
+static double cgroup1_quota(const string &dir)
+{
+	string quota;
+	string period;
+	if (!read_line(dir + "/cpu.cfs_quota_us", &quota) || !read_line(dir + "/cpu.cfs_period_us", &period)) {
+		return NO_QUOTA;
+	}
+	double quota_us = atof(quota.c_str());
+	double period_us = atof(period.c_str());
+	if (quota_us <= 0 || period_us <= 0) return NO_QUOTA;
+	return quota_us / period_us;
+}
+
+/*
+ * the quota of a cgroup is limited by its ancestors, so the least one on the path is taken.
+ * in a container the path may not exist below the mount point, whose own quota is taken then.
+ */
+static double least_quota(const string &root, string path, double (*quota_of)(const string &))
+{
+	double least = NO_QUOTA;
+	for (;;) {
+		double quota = quota_of(root + path);
+		if (quota > 0 && (least < 0 || quota < least)) least = quota;
+		if (path.empty() || path == "/") break;
+		size_t slash = path.rfind('/');
+		path = (slash == 0 || slash == string::npos) ? "" : path.substr(0, slash);
+	}
+	return least;
+}
+
+static double cgroup_quota(void)
+{
+	double least = NO_QUOTA;
+	string path;
+	vector<double> quotas;
+	if (find_cgroup("", &path)) {
+		quotas.push_back(least_quota(CGROUP_ROOT, path, cgroup2_quota));
+		quotas.push_back(least_quota(CGROUP_ROOT "/unified", path, cgroup2_quota));
+	}
+	if (find_cgroup("cpu", &path)) {
+		quotas.push_back(least_quota(CGROUP_ROOT "/cpu", path, cgroup1_quota));
+		quotas.push_back(least_quota(CGROUP_ROOT "/cpu,cpuacct", path, cgroup1_quota));
+	}
+	for (size_t i = 0; i < quotas.size(); i++) {
+		if (quotas.at(i) > 0 && (least < 0 || quotas.at(i) < least)) least = quotas.at(i);
+	}
+	return least;
+}
+
+size_t available_cpu_num(void)
+{
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t cpu_num = (online > 0) ? online : 1;
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0 &&
+		(size_t)CPU_COUNT(&cpus) < cpu_num) {
+		cpu_num = CPU_COUNT(&cpus);
+	}
+	double quota = cgroup_quota();
+	if (quota > 0 && ceil(quota) < cpu_num) cpu_num = ceil(quota);
+	return (cpu_num > 0) ? cpu_num : 1;
+}
@@ -0,0 +1,320 @@
+#include <cpd/deparse_cache.hpp>
+#include <clx/md5.h>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DEPARSE_CACHE_MAGIC "CPDCACHE"
+#define DEPARSE_CACHE_VERSION 3
+#define DEPARSE_CACHE_MIN_CAPACITY 1024
+
+using namespace std;
+
+DeparseCacheKey::DeparseCacheKey(const DeparseCommand *cmd, const char *src)
+{
+	clx::md5 md5;
+	md5.update(cmd->process, strlen(cmd->process));
+	md5.update("", 1);
+	md5.update(cmd->stamp.data(), cmd->stamp.size());
+	md5.update("", 1);
+	md5.update(src, strlen(src));
+	md5.finish();
+	memcpy(digest, md5.code(), DEPARSE_CACHE_KEY_SIZE);
+}
+
+string DeparseCacheJournal::add(const DeparseCacheKey &key, const string &code)
+{
+	clx::md5 md5;
+	string hash = (code.empty()) ? "" : md5.encode(code.substr(0, code.size() - 1)).to_string();
+	string key_str((const char *)key.digest, DEPARSE_CACHE_KEY_SIZE);
+	if (record_map.find(key_str) == record_map.end()) {
+		DeparseCacheRecord record;
+		record.key = key_str;
+		record.code = code;
+		record.hash = hash;
+		record_map.insert(make_pair(key_str, records.size()));
+		records.push_back(record);
+	}
+	return hash;
+}
+
+DeparseCache::DeparseCache(const char *dir_, size_t max_size_) :
+	dir(dir_), max_size(max_size_), data(NULL), data_size(0),
+	index(NULL), index_size(0), header(NULL), slots(NULL)
+{
+	int lock_fd = open(path("lock").c_str(), O_RDONLY | O_CLOEXEC);
+	/* the index and the data are replaced together by commit() */
+	if (lock_fd >= 0) flock(lock_fd, LOCK_SH);
+	load();
+	if (lock_fd >= 0) close(lock_fd);
+}
+
+DeparseCache::~DeparseCache(void)
+{
+	unload();
+}
+
+string DeparseCache::path(const char *name) const
+{
+	return dir + "/" + name;
+}
+
+static void *map_file(const string &path, size_t *size)
+{
+	*size = 0;
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	struct stat st;
+	void *addr = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED) {
+			addr = NULL;
+		} else {
+			*size = st.st_size;
+		}
+	}
+	close(fd);
+	return addr;
+}
+
+string DeparseCache::data_path(uint32_t data_id) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "data.%u", data_id);
+	return path(name);
+}
+
+void DeparseCache::load(void)
+{
+	index = map_file(path("index"), &index_size);
+	if (!index || index_size < sizeof(DeparseCacheHeader)) return;
+	const DeparseCacheHeader *index_header = (const DeparseCacheHeader *)index;
+	if (memcmp(index_header->magic, DEPARSE_CACHE_MAGIC, sizeof(index_header->magic)) != 0 ||
+		index_header->version != DEPARSE_CACHE_VERSION ||
+		index_size < sizeof(DeparseCacheHeader) + index_header->capacity * sizeof(DeparseCacheSlot) ||
+		(index_header->capacity & (index_header->capacity - 1)) != 0) {
+		/* broken or old cache is rebuilt by commit() */
+		return;
+	}
+	size_t mapped_data_size;
+	data = (const char *)map_file(data_path(index_header->data_id), &mapped_data_size);
+	data_size = mapped_data_size;
+	if (index_header->data_size > data_size) return;
+	header = index_header;
+	slots = (const DeparseCacheSlot *)((const char *)index + sizeof(DeparseCacheHeader));
+}
+
+void DeparseCache::unload(void)
+{
+	if (index) munmap(index, index_size);
+	if (data) munmap((void *)data, data_size);
+	index = NULL;
+	index_size = 0;
+	data = NULL;
+	data_size = 0;
+	header = NULL;
+	slots = NULL;
+}
+
+static uint32_t slot_position(const unsigned char *key, uint32_t capacity)
+{
+	uint32_t position;
+	memcpy(&position, key, sizeof(position));
+	return position & (capacity - 1);
+}
+
+const DeparseCacheSlot *DeparseCache::find(const unsigned char *key) const
+{
+	if (!header || header->capacity == 0) return NULL;
+	uint32_t capacity = header->capacity;
+	for (uint32_t i = 0, pos = slot_position(key, capacity); i < capacity; i++, pos = (pos + 1) & (capacity - 1)) {
+		const DeparseCacheSlot *slot = slots + pos;
+		if (slot->generation == 0) return NULL;
+		if (memcmp(slot->key, key, DEPARSE_CACHE_KEY_SIZE) == 0) return slot;
+	}
+	return NULL;
+}
+
+bool DeparseCache::lookup(const DeparseCacheKey &key, string *code, string *hash,
+						  DeparseCacheJournal *journal) const
+{
+	std::map<string, size_t>::iterator it =
+		journal->record_map.find(string((const char *)key.digest, DEPARSE_CACHE_KEY_SIZE));
+	if (it != journal->record_map.end()) {
+		const DeparseCacheRecord &record = journal->records.at(it->second);
+		*code = record.code;
+		*hash = record.hash;
+		return true;
+	}
+	const DeparseCacheSlot *slot = find(key.digest);
+	if (!slot || slot->offset + slot->size > header->data_size) return false;
+	code->assign(data + slot->offset, slot->size);
+	hash->assign(slot->hash, (slot->size > 0) ? DEPARSE_CACHE_HASH_SIZE : 0);
+	journal->used_slots.push_back(slot - slots);
+	journal->hit_num++;
+	return true;
+}
+
+static bool write_all(int fd, const char *buf, size_t size)
+{
+	while (size > 0) {
+		ssize_t written = write(fd, buf, size);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		buf += written;
+		size -= written;
+	}
+	return true;
+}
+
+static bool newer_slot(const DeparseCacheSlot &a, const DeparseCacheSlot &b)
+{
+	return a.generation > b.generation;
+}
+
+void DeparseCache::commit(const vector<DeparseCacheJournal *> &journals)
+{
+	mkdir(dir.c_str(), 0755);
+	int lock_fd = open(path("lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (lock_fd < 0) return;
+	flock(lock_fd, LOCK_EX);
+	vector<string> used_keys;
+	for (size_t i = 0; i < journals.size(); i++) {
+		const vector<uint32_t> &used_slots = journals.at(i)->used_slots;
+		for (size_t j = 0; j < used_slots.size(); j++) {
+			used_keys.push_back(string((const char *)slots[used_slots.at(j)].key, DEPARSE_CACHE_KEY_SIZE));
+		}
+	}
+	/* take the codes committed by other runs since this cache was loaded */
+	unload();
+	load();
+	uint32_t generation = (header) ? header->generation + 1 : 1;
+	vector<DeparseCacheSlot> entries;
+	std::map<string, size_t> entry_map;
+	for (uint32_t i = 0; header && i < header->capacity; i++) {
+		const DeparseCacheSlot &slot = slots[i];
+		if (slot.generation == 0 || slot.offset + slot.size > header->data_size) continue;
+		entry_map.insert(make_pair(string((const char *)slot.key, DEPARSE_CACHE_KEY_SIZE), entries.size()));
+		entries.push_back(slot);
+	}
+	for (size_t i = 0; i < used_keys.size(); i++) {
+		std::map<string, size_t>::iterator it = entry_map.find(used_keys.at(i));
+		if (it != entry_map.end()) entries.at(it->second).generation = generation;
+	}
+	/*
+	 * a cache without an index starts a data file of its own. an interrupted
+	 * run may have left the file, which is unlinked rather than truncated, as
+	 * other runs may have mapped it.
+	 */
+	uint32_t data_id = (header) ? header->data_id : generation;
+	if (!header) unlink(data_path(data_id).c_str());
+	int data_fd = open(data_path(data_id).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	struct stat st;
+	if (data_fd < 0 || fstat(data_fd, &st) != 0) {
+		if (data_fd >= 0) close(data_fd);
+		close(lock_fd);
+		return;
+	}
+	/* the codes after data_size were appended by a run which couldn't write its index */
+	uint64_t data_end = st.st_size;
+	for (size_t i = 0; i < journals.size(); i++) {
+		const vector<DeparseCacheRecord> &records = journals.at(i)->records;
+		for (size_t j = 0; j < records.size(); j++) {
+			const DeparseCacheRecord &record = records.at(j);
+			std::map<string, size_t>::iterator it = entry_map.find(record.key);
+			if (it != entry_map.end()) {
+				entries.at(it->second).generation = generation;
+				continue;
+			}
+			if (!write_all(data_fd, record.code.data(), record.code.size())) break;
+			DeparseCacheSlot slot;
+			memset(&slot, 0, sizeof(slot));
+			memcpy(slot.key, record.key.data(), DEPARSE_CACHE_KEY_SIZE);
+			memcpy(slot.hash, record.hash.data(), min(record.hash.size(), (size_t)DEPARSE_CACHE_HASH_SIZE));
+			slot.offset = data_end;
+			slot.size = record.code.size();
+			slot.generation = generation;
+			data_end += record.code.size();
+			entry_map.insert(make_pair(record.key, entries.size()));
+			entries.push_back(slot);
+		}
+	}
+	close(data_fd);
+	uint32_t new_data_id = data_id;
+	if (data_end > max_size) {
+		/* keep the recently used codes up to 3/4 of max_size, so that it isn't compacted every run */
+		sort(entries.begin(), entries.end(), newer_slot);
+		string compacted;
+		size_t kept = 0;
+		int reader = open(data_path(data_id).c_str(), O_RDONLY | O_CLOEXEC);
+		for (; reader >= 0 && kept < entries.size(); kept++) {
+			DeparseCacheSlot &slot = entries.at(kept);
+			size_t offset = compacted.size();
+			if (offset + slot.size > max_size / 4 * 3) break;
+			compacted.resize(offset + slot.size);
+			if (slot.size > 0 && pread(reader, &compacted[offset], slot.size, slot.offset) != (ssize_t)slot.size) {
+				compacted.resize(offset);
+				break;
+			}
+			slot.offset = offset;
+		}
+		if (reader >= 0) close(reader);
+		entries.resize(kept);
+		/* no index has referred to a data_id above the generations written so far */
+		new_data_id = max(generation, data_id + 1);
+		unlink(data_path(new_data_id).c_str());
+		int compacted_fd = open(data_path(new_data_id).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (compacted_fd < 0 || !write_all(compacted_fd, compacted.data(), compacted.size())) {
+			if (compacted_fd >= 0) close(compacted_fd);
+			unlink(data_path(new_data_id).c_str());
+			close(lock_fd);
+			return;
+		}
+		close(compacted_fd);
+		data_end = compacted.size();
+	}
+	uint32_t capacity = DEPARSE_CACHE_MIN_CAPACITY;
+	while (capacity < entries.size() * 2) capacity *= 2;
+	vector<DeparseCacheSlot> table(capacity);
+	memset(&table[0], 0, capacity * sizeof(DeparseCacheSlot));
+	for (size_t i = 0; i < entries.size(); i++) {
+		const DeparseCacheSlot &slot = entries.at(i);
+		uint32_t pos = slot_position(slot.key, capacity);
+		while (table[pos].generation != 0) pos = (pos + 1) & (capacity - 1);
+		table[pos] = slot;
+	}
+	DeparseCacheHeader new_header;
+	memset(&new_header, 0, sizeof(new_header));
+	memcpy(new_header.magic, DEPARSE_CACHE_MAGIC, sizeof(new_header.magic));
+	new_header.version = DEPARSE_CACHE_VERSION;
+	new_header.capacity = capacity;
+	new_header.count = entries.size();
+	new_header.generation = generation;
+	new_header.data_size = data_end;
+	new_header.data_id = new_data_id;
+	/* the index is the only file replaced, so a run stopped before the rename keeps the old cache */
+	string tmp_index = path("index.tmp");
+	int index_fd = open(tmp_index.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	bool is_committed = false;
+	if (index_fd >= 0) {
+		bool written = write_all(index_fd, (const char *)&new_header, sizeof(new_header)) &&
+			write_all(index_fd, (const char *)&table[0], capacity * sizeof(DeparseCacheSlot));
+		close(index_fd);
+		is_committed = written && rename(tmp_index.c_str(), path("index").c_str()) == 0;
+		if (!is_committed) unlink(tmp_index.c_str());
+	}
+	if (new_data_id != data_id) unlink(data_path((is_committed) ? data_id : new_data_id).c_str());
+	/* the next run of the engine looks up the codes of this one */
+	unload();
+	load();
+	close(lock_fd);
+}
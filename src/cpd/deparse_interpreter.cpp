@@ -0,0 +1,173 @@
+#include <cpd/deparse_interpreter.hpp>
+#include <cpd/op_fingerprint.hpp>
+#include <string.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "EXTERN.h"
+#include "perl.h"
+
+EXTERN_C void boot_DynaLoader(pTHX_ CV *cv);
+
+#ifdef __cplusplus
+};
+#endif
+
+#define DEPARSER_MODULE "Compiler::Tools::CopyPasteDetector::Deparser"
+/* the closure is made by the '-e' program, so it compiles statements
+   under the pragmas given by the -M switches like 'perl -MO=Deparse -e' */
+#define COMPILE_VAR DEPARSER_MODULE "::COMPILE"
+#define EMBED_PROGRAM "$" COMPILE_VAR " = sub { eval $_[0] }"
+
+using namespace std;
+
+static void xs_init(pTHX)
+{
+	newXS((char *)"DynaLoader::boot_DynaLoader", boot_DynaLoader, (char *)__FILE__);
+}
+
+DeparseInterpreter::DeparseInterpreter(const DeparseCommand *cmd) :
+	key(cmd->process), perl(NULL), compile(NULL), is_alive(false)
+{
+	vector<string> args;
+	args.push_back("perl");
+	args.insert(args.end(), cmd->args.begin(), cmd->args.end());
+	args.push_back("-M" DEPARSER_MODULE);
+	args.push_back("-e");
+	args.push_back(EMBED_PROGRAM);
+	vector<char *> argv;
+	for (size_t i = 0; i < args.size(); i++) {
+		argv.push_back((char *)args.at(i).c_str());
+	}
+	argv.push_back(NULL);
+
+	/* a single job runs the workers in the thread of the caller, whose interpreter is given back */
+	PerlInterpreter *caller = (PerlInterpreter *)PERL_GET_CONTEXT;
+	PerlInterpreter *my_perl = perl_alloc();
+	if (!my_perl) return;
+	perl = my_perl;
+	PERL_SET_CONTEXT(my_perl);
+	perl_construct(my_perl);
+	PL_perl_destruct_level = 1;
+	PL_exit_flags |= PERL_EXIT_DESTRUCT_END;
+	if (perl_parse(my_perl, xs_init, (int)args.size(), &argv[0], NULL) == 0 && perl_run(my_perl) == 0) {
+		compile = get_sv(COMPILE_VAR, 0);
+		is_alive = (compile && SvROK(compile));
+	}
+	PERL_SET_CONTEXT(caller);
+}
+
+DeparseInterpreter::~DeparseInterpreter(void)
+{
+	if (!perl) return;
+	PerlInterpreter *caller = (PerlInterpreter *)PERL_GET_CONTEXT;
+	PerlInterpreter *my_perl = perl;
+	PERL_SET_CONTEXT(my_perl);
+	perl_destruct(my_perl);
+	perl_free(my_perl);
+	PERL_SET_CONTEXT(caller);
+}
+
+bool DeparseInterpreter::deparse(const char *src, string *code)
+{
+	if (!is_alive) return false;
+	PerlInterpreter *caller = (PerlInterpreter *)PERL_GET_CONTEXT;
+	PerlInterpreter *my_perl = perl;
+	PERL_SET_CONTEXT(my_perl);
+	bool deparsed = false;
+	dSP;
+	ENTER;
+	SAVETMPS;
+	PUSHMARK(SP);
+	XPUSHs(compile);
+	XPUSHs(sv_2mortal(newSVpv(src, strlen(src))));
+	PUTBACK;
+	int count = call_pv(DEPARSER_MODULE "::deparse_stmt", G_SCALAR | G_EVAL);
+	SPAGAIN;
+	if (count == 1) {
+		SV *ret = POPs;
+		if (!SvTRUE(ERRSV) && SvOK(ret)) {
+			STRLEN len;
+			const char *deparsed_code = SvPV(ret, len);
+			code->assign(deparsed_code, len);
+			deparsed = true;
+		}
+	}
+	PUTBACK;
+	FREETMPS;
+	LEAVE;
+	PERL_SET_CONTEXT(caller);
+	return deparsed;
+}
+
+bool DeparseInterpreter::fingerprint(const char *src, bool abstracts_variables, string *hash)
+{
+	if (!is_alive) return false;
+	PerlInterpreter *caller = (PerlInterpreter *)PERL_GET_CONTEXT;
+	PerlInterpreter *my_perl = perl;
+	PERL_SET_CONTEXT(my_perl);
+	bool compiled = false;
+	dSP;
+	ENTER;
+	SAVETMPS;
+	PUSHMARK(SP);
+	XPUSHs(compile);
+	XPUSHs(sv_2mortal(newSVpv(src, strlen(src))));
+	PUTBACK;
+	int count = call_pv(DEPARSER_MODULE "::compile_stmt", G_SCALAR | G_EVAL);
+	SPAGAIN;
+	if (count == 1) {
+		SV *ret = POPs;
+		if (!SvTRUE(ERRSV) && SvROK(ret) && SvTYPE(SvRV(ret)) == SVt_PVCV) {
+			/* the tree must be walked before the sub is freed by FREETMPS */
+			OpFingerprint op_fingerprint(abstracts_variables);
+			if (!op_fingerprint.make((CV *)SvRV(ret), hash)) hash->clear();
+			compiled = true;
+		}
+	}
+	PUTBACK;
+	FREETMPS;
+	LEAVE;
+	PERL_SET_CONTEXT(caller);
+	return compiled;
+}
+
+DeparseInterpreterPool::DeparseInterpreterPool(size_t max_interpreter_num_, bool fingerprints_, bool abstracts_variables_) :
+	max_interpreter_num(max_interpreter_num_), fingerprints(fingerprints_), abstracts_variables(abstracts_variables_) {}
+
+DeparseInterpreterPool::~DeparseInterpreterPool(void)
+{
+	for (size_t i = 0; i < interpreters.size(); i++) {
+		delete interpreters.at(i);
+	}
+}
+
+DeparseInterpreter *DeparseInterpreterPool::get(const DeparseCommand *cmd)
+{
+	for (size_t i = 0; i < interpreters.size(); i++) {
+		DeparseInterpreter *interpreter = interpreters.at(i);
+		if (interpreter->key != cmd->process) continue;
+		/* a broken interpreter is kept, so its statements just fall back to the process */
+		interpreters.erase(interpreters.begin() + i);
+		interpreters.push_back(interpreter);
+		return interpreter;
+	}
+	if (interpreters.size() >= max_interpreter_num) {
+		delete interpreters.front();
+		interpreters.erase(interpreters.begin());
+	}
+	DeparseInterpreter *interpreter = new DeparseInterpreter(cmd);
+	interpreters.push_back(interpreter);
+	return interpreter;
+}
+
+bool DeparseInterpreterPool::deparse(const DeparseCommand *cmd, const char *src, string *code)
+{
+	return get(cmd)->deparse(src, code);
+}
+
+bool DeparseInterpreterPool::fingerprint(const DeparseCommand *cmd, const char *src, string *hash)
+{
+	if (!fingerprints) return false;
+	return get(cmd)->fingerprint(src, abstracts_variables, hash);
+}
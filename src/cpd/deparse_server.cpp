@@ -0,0 +1,177 @@
+#include <cpd/deparse_server.hpp>
+#include <cpd/process.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define READ_BUF_SIZE 65536
+
+using namespace std;
+
+DeparseServer::DeparseServer(const vector<string> &argv_) :
+	argv(argv_), pid(-1), writer(-1), reader(-1), is_alive(false),
+	buf(READ_BUF_SIZE), buf_begin(0), buf_end(0)
+{
+	int request[2];
+	int response[2];
+	if (pipe2(request, O_CLOEXEC) < 0) return;
+	if (pipe2(response, O_CLOEXEC) < 0) {
+		close(request[0]);
+		close(request[1]);
+		return;
+	}
+	vector<int> fds;
+	fds.push_back(request[0]);
+	fds.push_back(response[1]);
+	fds.push_back(-1);
+	pid = spawn_process(argv, fds);
+	close(request[0]);
+	close(response[1]);
+	if (pid < 0) {
+		close(request[1]);
+		close(response[0]);
+		return;
+	}
+	writer = request[1];
+	reader = response[0];
+	is_alive = true;
+}
+
+DeparseServer::DeparseServer(int fd) :
+	pid(-1), writer(fd), reader(fd), is_alive(fd >= 0),
+	buf(READ_BUF_SIZE), buf_begin(0), buf_end(0) {}
+
+DeparseServer::~DeparseServer(void)
+{
+	shutdown();
+}
+
+void DeparseServer::shutdown(void)
+{
+	is_alive = false;
+	if (writer >= 0) close(writer);
+	if (reader >= 0 && reader != writer) close(reader);
+	writer = reader = -1;
+	if (pid > 0) {
+		/* the server exits by EOF of the request pipe */
+		while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+	}
+	pid = -1;
+}
+
+bool DeparseServer::deparse(const char *src, string *code)
+{
+	if (!is_alive) return false;
+	size_t src_len = strlen(src);
+	char header[32] = {0};
+	int header_len = snprintf(header, sizeof(header), "%lu\n", (unsigned long)src_len);
+	string line;
+	if (!write_all(header, header_len) || !write_all(src, src_len) || !read_line(&line)) {
+		shutdown();
+		return false;
+	}
+	long code_len = atol(line.c_str());
+	if (code_len < 0) return false;
+	code->clear();
+	if (!read_exact(code_len, code)) {
+		shutdown();
+		return false;
+	}
+	return true;
+}
+
+bool DeparseServer::write_all(const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t written = write(writer, data, size);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool DeparseServer::fill(void)
+{
+	buf_begin = buf_end = 0;
+	for (;;) {
+		ssize_t n = read(reader, &buf[0], buf.size());
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		buf_end = n;
+		return true;
+	}
+}
+
+bool DeparseServer::read_line(string *line)
+{
+	line->clear();
+	for (;;) {
+		if (buf_begin == buf_end && !fill()) return false;
+		char *begin = &buf[buf_begin];
+		char *newline = (char *)memchr(begin, '\n', buf_end - buf_begin);
+		if (newline) {
+			line->append(begin, newline - begin);
+			buf_begin += newline - begin + 1;
+			return true;
+		}
+		line->append(begin, buf_end - buf_begin);
+		buf_begin = buf_end;
+	}
+}
+
+bool DeparseServer::read_exact(size_t size, string *data)
+{
+	data->reserve(size);
+	while (size > 0) {
+		if (buf_begin == buf_end && !fill()) return false;
+		size_t n = buf_end - buf_begin;
+		if (n > size) n = size;
+		data->append(&buf[buf_begin], n);
+		buf_begin += n;
+		size -= n;
+	}
+	return true;
+}
+
+DeparseServerPool::DeparseServerPool(size_t max_server_num_) :
+	max_server_num(max_server_num_) {}
+
+DeparseServerPool::~DeparseServerPool(void)
+{
+	for (size_t i = 0; i < servers.size(); i++) {
+		delete servers.at(i);
+	}
+}
+
+DeparseServer *DeparseServerPool::get(const vector<string> &argv)
+{
+	for (size_t i = 0; i < servers.size(); i++) {
+		DeparseServer *server = servers.at(i);
+		if (server->argv != argv) continue;
+		/* a dead server is kept, so its statements just fall back to the process */
+		servers.erase(servers.begin() + i);
+		servers.push_back(server);
+		return server;
+	}
+	if (servers.size() >= max_server_num) {
+		delete servers.front();
+		servers.erase(servers.begin());
+	}
+	DeparseServer *server = new DeparseServer(argv);
+	servers.push_back(server);
+	return server;
+}
+
+bool DeparseServerPool::deparse(const DeparseCommand *cmd, const char *src, string *code)
+{
+	if (cmd->server_argv.empty()) return false;
+	return get(cmd->server_argv)->deparse(src, code);
+}
@@ -0,0 +1,142 @@
+#include <cpd/file_deparser.hpp>
+#include <cpd/process.hpp>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEPARSE_INDENT_SIZE 4
+
+using namespace std;
+
+static bool parse_marker(const string &text, int *line)
+{
+	if (text.compare(0, 6, "#line ") != 0) return false;
+	*line = atoi(text.c_str() + 6);
+	return true;
+}
+
+static bool starts_with(const string &text, size_t pos, const char *prefix)
+{
+	return text.compare(pos, strlen(prefix), prefix) == 0;
+}
+
+/* declarations are printed with the pragmas they change, so they are left to the per-statement deparse */
+static bool is_declaration(const string &code)
+{
+	static const char *keywords[] = {
+		"use ", "no ", "package ", "sub ", "format ",
+		"BEGIN ", "UNITCHECK ", "CHECK ", "INIT ", "END ", NULL
+	};
+	for (size_t i = 0; keywords[i]; i++) {
+		if (starts_with(code, 0, keywords[i])) return true;
+	}
+	return false;
+}
+
+bool FileDeparser::deparse(const vector<string> &argv, const char *filename)
+{
+	vector<string> file_argv = argv;
+	file_argv.push_back(filename);
+	string output;
+	/* a file which doesn't compile is deparsed statement by statement */
+	if (!run_process(file_argv, "", &output)) return false;
+	parse(output);
+	return true;
+}
+
+void FileDeparser::parse(const string &output)
+{
+	vector<string> lines;
+	size_t begin = 0;
+	while (begin < output.size()) {
+		size_t end = output.find('\n', begin);
+		if (end == string::npos) end = output.size();
+		lines.push_back(output.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	/* markers are printed at the top of the line, so the depth of a
+	   marker is taken from the indent of the next line of code */
+	vector<size_t> indents(lines.size() + 1, 0);
+	for (size_t i = lines.size(); i > 0; i--) {
+		const string &text = lines.at(i - 1);
+		int line;
+		size_t spaces = text.find_first_not_of(' ');
+		if (spaces == string::npos || parse_marker(text, &line)) {
+			indents[i - 1] = indents[i];
+		} else {
+			indents[i - 1] = spaces;
+		}
+	}
+	for (size_t i = 0; i < lines.size(); i++) {
+		int line;
+		if (!parse_marker(lines.at(i), &line) || line <= 0) continue;
+		size_t indent = indents[i];
+		DeparsedSegment segment(line, indent / DEPARSE_INDENT_SIZE);
+		string branch;
+		for (size_t j = i + 1; j < lines.size(); j++) {
+			const string &text = lines.at(j);
+			int nested_line;
+			if (parse_marker(text, &nested_line)) {
+				if (indents[j] <= indent) break;
+				continue;
+			}
+			size_t spaces = text.find_first_not_of(' ');
+			if (spaces == string::npos) {
+				branch += "\n";
+				continue;
+			}
+			if (spaces < indent) break;
+			if (spaces == indent && !branch.empty() &&
+				(starts_with(text, spaces, "elsif ") || starts_with(text, spaces, "else "))) {
+				segment.branches.push_back(branch);
+				branch = "";
+			}
+			branch += text.substr(indent) + "\n";
+		}
+		segment.branches.push_back(branch);
+		for (size_t j = 0; j < segment.branches.size(); j++) {
+			string &code = segment.branches.at(j);
+			while (code.size() > 1 && code.compare(code.size() - 2, 2, "\n\n") == 0) {
+				code.erase(code.size() - 1);
+			}
+		}
+		/* the marker of the closing brace of a sub, and declarations */
+		const string &head = segment.branches.front();
+		if (head.empty() || head.at(0) == '}' || is_declaration(head)) continue;
+		segments.push_back(segment);
+	}
+}
+
+void FileDeparser::assign(const Task *task, map<size_t, string> *codes)
+{
+	multimap<pair<int, size_t>, size_t> segment_map;
+	for (size_t i = 0; i < segments.size(); i++) {
+		const DeparsedSegment &segment = segments.at(i);
+		segment_map.insert(make_pair(make_pair(segment.line, segment.depth), i));
+	}
+	/* the if statement followed by its elsif and else statements, keyed by indent and block_id */
+	map<pair<int, int>, pair<size_t, size_t> > chains;
+	for (size_t i = 0; i < task->stmts.size(); i++) {
+		const Stmt *stmt = task->stmts.at(i);
+		pair<int, int> chain_key = make_pair(stmt->indent, stmt->block_id);
+		string src = stmt->src;
+		if (src.find("else") == 1) {
+			map<pair<int, int>, pair<size_t, size_t> >::iterator chain = chains.find(chain_key);
+			if (chain == chains.end()) continue;
+			const DeparsedSegment &segment = segments.at(chain->second.first);
+			size_t branch_idx = chain->second.second++;
+			if (branch_idx < segment.branches.size()) {
+				codes->insert(make_pair(i, segment.branches.at(branch_idx)));
+			}
+			continue;
+		}
+		chains.erase(chain_key);
+		if (stmt->indent < 0) continue;
+		multimap<pair<int, size_t>, size_t>::iterator it =
+			segment_map.find(make_pair(stmt->start_line, (size_t)stmt->indent));
+		if (it == segment_map.end()) continue;
+		size_t segment_idx = it->second;
+		segment_map.erase(it);
+		codes->insert(make_pair(i, segments.at(segment_idx).branches.front()));
+		chains.insert(make_pair(chain_key, make_pair(segment_idx, (size_t)1)));
+	}
+}
@@ -0,0 +1,121 @@
+#include <cpd/lexical_normalizer.hpp>
+#include <string.h>
+
+using namespace std;
+
+LexicalNormalizer::LexicalNormalizer(bool abstracts_literals_) :
+	abstracts_literals(abstracts_literals_) {}
+
+static string squeeze(const string &text)
+{
+	string squeezed;
+	for (size_t i = 0; i < text.size(); i++) {
+		if (!strchr(" \t\r\n", text.at(i))) squeezed += text.at(i);
+	}
+	return squeezed;
+}
+
+/* removes the quotes of a string token if the lexer keeps them */
+static string unquote(const string &data)
+{
+	size_t size = data.size();
+	if (size >= 2 && (data.at(0) == '"' || data.at(0) == '\'') && data.at(size - 1) == data.at(0)) {
+		return data.substr(1, size - 2);
+	}
+	return data;
+}
+
+TokenClass LexicalNormalizer::class_of(const SourceToken &token) const
+{
+	map<int, TokenClass>::const_iterator it = classes.find(token.type);
+	return (it != classes.end()) ? it->second : TokenOther;
+}
+
+/*
+ * the tokens of a statement are the token_num tokens from its start_line.
+ * statements starting at the same line are told apart by their source.
+ */
+size_t LexicalNormalizer::find_tokens(const Task *task, const Stmt *stmt) const
+{
+	map<int, size_t>::const_iterator it = task->token_lines.find(stmt->start_line);
+	if (it == task->token_lines.end() || stmt->token_num <= 0) return string::npos;
+	const vector<SourceToken> &tokens = task->tokens;
+	size_t token_num = stmt->token_num;
+	size_t found = string::npos;
+	string src;
+	for (size_t begin = it->second; begin < tokens.size() && tokens.at(begin).line == stmt->start_line; begin++) {
+		if (begin + token_num > tokens.size()) break;
+		if (tokens.at(begin + token_num - 1).line > stmt->end_line) continue;
+		if (found == string::npos) {
+			found = begin;
+			src = squeeze(stmt->src);
+		}
+		string data;
+		for (size_t i = begin; i < begin + token_num; i++) {
+			data += tokens.at(i).data;
+		}
+		if (squeeze(data) == src) return begin;
+	}
+	return found;
+}
+
+string LexicalNormalizer::normalize(const Task *task, const Stmt *stmt) const
+{
+	size_t begin = find_tokens(task, stmt);
+	if (begin == string::npos) return "";
+	/* the placeholders of abstracted literals */
+	const string string_placeholder = "\"\"";
+	const string number_placeholder = "0";
+	string code;
+	/* 0: out of q or qq, 1: before the opening delimiter, 2: in the content */
+	int quote_state = 0;
+	bool has_content = false;
+	for (size_t i = begin; i < begin + stmt->token_num; i++) {
+		const SourceToken &token = task->tokens.at(i);
+		TokenClass token_class = class_of(token);
+		string text;
+		if (quote_state > 0) {
+			if (token_class == TokenDelim) {
+				if (quote_state == 2 && !has_content) text = "\"\"";
+				quote_state = (quote_state == 1) ? 2 : 0;
+			} else {
+				text = (abstracts_literals) ? string_placeholder : "\"" + token.data + "\"";
+				has_content = true;
+				/* the content without delimiters */
+				if (quote_state == 1) quote_state = 0;
+			}
+		} else {
+			switch (token_class) {
+			case TokenComment:
+				break;
+			case TokenString:
+			case TokenKey:
+				text = (abstracts_literals && token_class == TokenString) ? string_placeholder : "\"" + unquote(token.data) + "\"";
+				break;
+			case TokenNumber:
+				if (abstracts_literals) {
+					text = number_placeholder;
+				} else {
+					for (size_t j = 0; j < token.data.size(); j++) {
+						if (token.data.at(j) != '_') text += token.data.at(j);
+					}
+				}
+				break;
+			case TokenQuote:
+				quote_state = 1;
+				has_content = false;
+				break;
+			case TokenDelim:
+				text = "/";
+				break;
+			default:
+				text = token.data;
+				break;
+			}
+		}
+		if (text.empty()) continue;
+		if (!code.empty()) code += " ";
+		code += text;
+	}
+	return code;
+}
@@ -0,0 +1,95 @@
+#include <clx/md5.h>
+#include <cpd/lexical_prefilter.hpp>
+#include <algorithm>
+#include <ctype.h>
+#include <map>
+
+using namespace std;
+
+LexicalPrefilter::LexicalPrefilter(const LexicalNormalizer *normalizer_) :
+	normalizer(normalizer_) {}
+
+/*
+ * words which B::Deparse may add, drop or rewrite (e.g. 'for' is deparsed as
+ * 'foreach', 'if (!$a)' as 'unless ($a)' and 'while (!$a)' as 'until ($a)')
+ */
+static bool is_unstable_word(const string &word)
+{
+	static const char *unstable_words[] = {
+		"for", "foreach", "if", "unless", "while", "until",
+		"q", "qq", "qw", "and", "or", "not", "xor",
+		"__PACKAGE__", "__FILE__", "__LINE__", NULL
+	};
+	for (size_t i = 0; unstable_words[i]; i++) {
+		if (word == unstable_words[i]) return true;
+	}
+	return false;
+}
+
+static void split_words(const string &data, vector<string> *words)
+{
+	size_t i = 0;
+	while (i < data.size()) {
+		unsigned char c = data.at(i);
+		if (!isalnum(c) && c != '_') {
+			i++;
+			continue;
+		}
+		size_t begin = i;
+		while (i < data.size() && (isalnum((unsigned char)data.at(i)) || data.at(i) == '_')) i++;
+		/* numbers are folded and reformatted by B::Deparse */
+		if (isdigit(c)) continue;
+		string word = data.substr(begin, i - begin);
+		if (!is_unstable_word(word)) words->push_back(word);
+	}
+}
+
+/* returns an empty bucket if the statement can't be told from the others by its words */
+string LexicalPrefilter::bucket(const Task *task, const Stmt *stmt) const
+{
+	size_t begin = normalizer->find_tokens(task, stmt);
+	if (begin == string::npos) return "";
+	vector<string> words;
+	for (size_t i = begin; i < begin + stmt->token_num; i++) {
+		const SourceToken &token = task->tokens.at(i);
+		if (normalizer->class_of(token) == TokenComment) continue;
+		split_words(token.data, &words);
+	}
+	if (words.empty()) return "";
+	sort(words.begin(), words.end());
+	string text;
+	for (size_t i = 0; i < words.size(); i++) {
+		text += words.at(i) + " ";
+	}
+	clx::md5 md5;
+	return md5.encode(text).to_string();
+}
+
+void LexicalPrefilter::count(const vector<Task *> &tasks)
+{
+	for (size_t i = 0; i < tasks.size(); i++) {
+		const Task *task = tasks.at(i);
+		for (size_t j = 0; j < task->stmts.size(); j++) {
+			string stmt_bucket = bucket(task, task->stmts.at(j));
+			if (!stmt_bucket.empty()) bucket_sizes[stmt_bucket]++;
+		}
+	}
+}
+
+size_t LexicalPrefilter::mark_unique_stmts(const vector<Task *> &tasks) const
+{
+	size_t unique_num = 0;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		Task *task = tasks.at(i);
+		for (size_t j = 0; j < task->stmts.size(); j++) {
+			string stmt_bucket = bucket(task, task->stmts.at(j));
+			if (stmt_bucket.empty()) continue;
+			map<string, size_t>::const_iterator it = bucket_sizes.find(stmt_bucket);
+			/* a statement which wasn't counted can't be told to be unique */
+			if (it == bucket_sizes.end() || it->second > 1) continue;
+			task->stmts.at(j)->is_unique = true;
+			unique_num++;
+		}
+	}
+	return unique_num;
+}
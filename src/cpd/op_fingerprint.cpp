@@ -0,0 +1,193 @@
+#include <clx/md5.h>
+#include <cpd/op_fingerprint.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "EXTERN.h"
+#include "perl.h"
+#ifdef __cplusplus
+};
+#endif
+
+#define MAX_OP_DEPTH 1024
+
+using namespace std;
+
+OpFingerprint::OpFingerprint(bool abstracts_variables_) :
+	abstracts_variables(abstracts_variables_), op_num(0) {}
+
+/* strings are prefixed by their size, so they can't be confused with the ops around them */
+void OpFingerprint::append(const char *data, size_t size)
+{
+	char size_buf[32] = {0};
+	snprintf(size_buf, sizeof(size_buf), "%lu:", (unsigned long)size);
+	text += size_buf;
+	text.append(data, size);
+}
+
+static SV *pad_sv(CV *cv, PADOFFSET targ)
+{
+	PAD *pad = PadlistARRAY(CvPADLIST(cv))[1];
+	if (!pad || targ == 0 || targ > (PADOFFSET)AvFILLp(pad)) return NULL;
+	return PadARRAY(pad)[targ];
+}
+
+static PADNAME *pad_name(CV *cv, PADOFFSET targ)
+{
+	PADNAMELIST *names = PadlistNAMES(CvPADLIST(cv));
+	if (!names || targ == 0 || targ > (PADOFFSET)PadnamelistMAX(names)) return NULL;
+	return PadnamelistARRAY(names)[targ];
+}
+
+/* under ithreads, constants and GVs of the ops are moved to the pad */
+static SV *op_sv(CV *cv, const OP *o)
+{
+	SV *sv = cSVOPx(o)->op_sv;
+	return (sv) ? sv : pad_sv(cv, o->op_targ);
+}
+
+void OpFingerprint::walk(const OP *o, CV *cv, size_t depth)
+{
+	dTHX;
+	if (depth > MAX_OP_DEPTH) return;
+	OPCODE type = o->op_type;
+	char op_buf[64] = {0};
+	snprintf(op_buf, sizeof(op_buf), "(%s %x %x", PL_op_name[type], o->op_flags, o->op_private);
+	text += op_buf;
+	switch (type) {
+	case OP_NULL:
+		/* the type of the op before it was optimized out */
+		if (o->op_targ < OP_max) text += string(" ") + PL_op_name[o->op_targ];
+		break;
+	case OP_NEXTSTATE: case OP_DBSTATE: case OP_RETURN: case OP_STUB:
+	case OP_LEAVESUB: case OP_LINESEQ: case OP_PUSHMARK:
+		break;
+	default:
+		op_num++;
+		break;
+	}
+	vector<PADOFFSET> targs;
+	switch (type) {
+	case OP_PADSV: case OP_PADAV: case OP_PADHV: case OP_PADCV: case OP_AELEMFAST_LEX:
+		targs.push_back(o->op_targ);
+		break;
+	case OP_PADRANGE:
+		for (PADOFFSET i = 0; i < (PADOFFSET)(o->op_private & OPpPADRANGE_COUNTMASK); i++) {
+			targs.push_back(o->op_targ + i);
+		}
+		break;
+	default:
+		if ((PL_opargs[type] & OA_TARGLEX) && (o->op_private & OPpTARGET_MY)) targs.push_back(o->op_targ);
+		break;
+	}
+	for (size_t i = 0; i < targs.size(); i++) {
+		PADNAME *name = pad_name(cv, targs.at(i));
+		if (!name || !PadnamePV(name)) continue;
+		if (abstracts_variables) {
+			map<const void *, size_t>::iterator it = variables.find(name);
+			if (it == variables.end()) it = variables.insert(make_pair((const void *)name, variables.size())).first;
+			char variable_buf[32] = {0};
+			snprintf(variable_buf, sizeof(variable_buf), " %c%lu", PadnamePV(name)[0], (unsigned long)it->second);
+			text += variable_buf;
+		} else {
+			text += " ";
+			append(PadnamePV(name), PadnameLEN(name));
+		}
+	}
+	SV *sv = NULL;
+	/* ops of GVs are declared as SVOPs, but they are PADOPs under ithreads */
+	OPCODE op_class = OP_CLASS(o);
+#ifdef USE_ITHREADS
+	if (type == OP_GV || type == OP_GVSV || type == OP_AELEMFAST || type == OP_RCATLINE) op_class = OA_PADOP;
+#endif
+	switch (op_class) {
+	case OA_SVOP:
+		sv = op_sv(cv, o);
+		if (type == OP_ANONCODE && sv && SvTYPE(sv) == SVt_PVCV && CvROOT((CV *)sv)) {
+			walk(CvROOT((CV *)sv), (CV *)sv, depth + 1);
+			sv = NULL;
+		}
+		break;
+	case OA_PADOP:
+		sv = pad_sv(cv, cPADOPx(o)->op_padix);
+		break;
+	case OA_METHOP:
+		if (type != OP_METHOD) {
+			sv = cMETHOPx(o)->op_u.op_meth_sv;
+			if (!sv) sv = pad_sv(cv, o->op_targ);
+		}
+		break;
+	case OA_PMOP: {
+		const PMOP *pm = cPMOPx(o);
+		REGEXP *rx = PM_GETRE(pm);
+		char flags_buf[32] = {0};
+		snprintf(flags_buf, sizeof(flags_buf), " %lx ", (unsigned long)pm->op_pmflags);
+		text += flags_buf;
+		if (rx) append(RX_PRECOMP(rx), RX_PRELEN(rx));
+		if (type == OP_SUBST && pm->op_pmreplrootu.op_pmreplroot) {
+			walk(pm->op_pmreplrootu.op_pmreplroot, cv, depth + 1);
+		}
+		break;
+	}
+	case OA_UNOP_AUX:
+		/* the strings are mortal */
+		if (type == OP_MULTIDEREF) {
+			sv = Perl_multideref_stringify(aTHX_ o, cv);
+		} else if (type == OP_MULTICONCAT) {
+			sv = Perl_multiconcat_stringify(aTHX_ o);
+		}
+		break;
+	default:
+		break;
+	}
+	if (sv) {
+		if (isGV_with_GP(sv)) {
+			HV *stash = GvSTASH((GV *)sv);
+			const char *stash_name = (stash) ? HvNAME(stash) : NULL;
+			text += " *";
+			if (stash_name) text += string(stash_name) + "::";
+			append(GvNAME((GV *)sv), GvNAMELEN((GV *)sv));
+		} else if (SvROK(sv)) {
+			text += string(" \\") + sv_reftype(SvRV(sv), 0);
+		} else if (SvPOK(sv)) {
+			text += (SvUTF8(sv)) ? " u" : " s";
+			append(SvPVX(sv), SvCUR(sv));
+		} else if (SvIOK(sv)) {
+			char number_buf[64] = {0};
+			if (SvIsUV(sv)) {
+				snprintf(number_buf, sizeof(number_buf), " i%" UVuf, SvUVX(sv));
+			} else {
+				snprintf(number_buf, sizeof(number_buf), " i%" IVdf, SvIVX(sv));
+			}
+			text += number_buf;
+		} else if (SvNOK(sv)) {
+			char number_buf[64] = {0};
+			snprintf(number_buf, sizeof(number_buf), " n%.17g", (double)SvNVX(sv));
+			text += number_buf;
+		} else {
+			text += " undef";
+		}
+	}
+	if (o->op_flags & OPf_KIDS) {
+		for (const OP *kid = cUNOPx(o)->op_first; kid; kid = OpSIBLING(kid)) {
+			walk(kid, cv, depth + 1);
+		}
+	}
+	text += ")";
+}
+
+bool OpFingerprint::make(CV *cv, string *hash)
+{
+	text.clear();
+	op_num = 0;
+	variables.clear();
+	if (!CvROOT(cv)) return false;
+	walk(CvROOT(cv), cv, 0);
+	if (op_num == 0) return false;
+	clx::md5 md5;
+	*hash = md5.encode(text).to_string();
+	return true;
+}
@@ -0,0 +1,164 @@
+#include <cpd/process.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define READ_BUF_SIZE 65536
+
+extern char **environ;
+
+using namespace std;
+
+Process::Process(void) : pid(-1), in(-1), out(-1), written(0) {}
+
+Process::~Process(void)
+{
+	if (in >= 0) close(in);
+	if (out >= 0) close(out);
+	if (pid > 0) wait();
+}
+
+pid_t spawn_process(const vector<string> &argv, const vector<int> &fds)
+{
+	if (argv.empty()) return -1;
+	vector<char *> args;
+	for (size_t i = 0; i < argv.size(); i++) {
+		args.push_back((char *)argv.at(i).c_str());
+	}
+	args.push_back(NULL);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	for (size_t i = 0; i < fds.size(); i++) {
+		if (fds.at(i) >= 0) {
+			posix_spawn_file_actions_adddup2(&actions, fds.at(i), i);
+		} else {
+			posix_spawn_file_actions_addopen(&actions, i, "/dev/null", O_RDWR, 0);
+		}
+	}
+	pid_t pid;
+	int spawn_error = posix_spawn(&pid, args[0], &actions, NULL, &args[0], environ);
+	posix_spawn_file_actions_destroy(&actions);
+	return (spawn_error == 0) ? pid : -1;
+}
+
+bool Process::spawn(const vector<string> &argv, const string &input_)
+{
+	if (argv.empty()) return false;
+	int in_fds[2];
+	int out_fds[2];
+	if (pipe2(in_fds, O_CLOEXEC) < 0) return false;
+	if (pipe2(out_fds, O_CLOEXEC) < 0) {
+		close(in_fds[0]);
+		close(in_fds[1]);
+		return false;
+	}
+	vector<int> fds;
+	fds.push_back(in_fds[0]);
+	fds.push_back(out_fds[1]);
+	fds.push_back(-1);
+	pid = spawn_process(argv, fds);
+	close(in_fds[0]);
+	close(out_fds[1]);
+	if (pid < 0) {
+		close(in_fds[1]);
+		close(out_fds[0]);
+		return false;
+	}
+	in = in_fds[1];
+	out = out_fds[0];
+	fcntl(in, F_SETFL, O_NONBLOCK);
+	fcntl(out, F_SETFL, O_NONBLOCK);
+	input = input_;
+	written = 0;
+	output.clear();
+	if (input.empty()) {
+		close(in);
+		in = -1;
+	}
+	return true;
+}
+
+bool Process::write_input(void)
+{
+	if (in < 0) return false;
+	ssize_t n = write(in, input.data() + written, input.size() - written);
+	if (n > 0) written += n;
+	if ((n < 0 && errno != EAGAIN && errno != EINTR) || written == input.size()) {
+		close(in);
+		in = -1;
+		return false;
+	}
+	return true;
+}
+
+bool Process::read_output(void)
+{
+	if (out < 0) return false;
+	char read_buf[READ_BUF_SIZE];
+	for (;;) {
+		ssize_t n = read(out, read_buf, READ_BUF_SIZE);
+		if (n > 0) {
+			output.append(read_buf, n);
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno == EAGAIN) return true;
+		close(out);
+		out = -1;
+		return false;
+	}
+}
+
+bool Process::wait(void)
+{
+	if (pid <= 0) return false;
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			pid = -1;
+			return false;
+		}
+	}
+	pid = -1;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool run_process(const vector<string> &argv, const string &input, string *output)
+{
+	output->clear();
+	Process process;
+	if (!process.spawn(argv, input)) return false;
+	/* perl reads the whole program before it prints anything, but stdin
+	   and stdout are polled together so that neither pipe can get stuck */
+	while (process.out >= 0) {
+		struct pollfd fds[2];
+		nfds_t nfds = 0;
+		fds[nfds].fd = process.out;
+		fds[nfds].events = POLLIN;
+		nfds++;
+		if (process.in >= 0) {
+			fds[nfds].fd = process.in;
+			fds[nfds].events = POLLOUT;
+			nfds++;
+		}
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (nfds > 1 && fds[1].revents) process.write_input();
+		if (fds[0].revents) process.read_output();
+	}
+	output->swap(process.output);
+	if (process.in >= 0) {
+		close(process.in);
+		process.in = -1;
+	}
+	if (process.out >= 0) {
+		close(process.out);
+		process.out = -1;
+	}
+	return process.wait();
+}
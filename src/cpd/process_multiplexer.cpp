@@ -0,0 +1,156 @@
+#include <cpd/cpu_quota.hpp>
+#include <cpd/process_multiplexer.hpp>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define MAX_EVENT_NUM 64
+#define INPUT_EVENT 1
+#define ADAPT_INTERVAL 0.5 /* seconds */
+#define THROUGHPUT_TOLERANCE 0.05
+
+using namespace std;
+
+ProcessMultiplexer::ProcessMultiplexer(size_t process_num_, size_t max_process_num_) :
+	process_num((process_num_ > 0) ? process_num_ : 1),
+	max_process_num((max_process_num_ > process_num) ? max_process_num_ : process_num),
+	cpu_num((max_process_num > process_num) ? available_cpu_num() : 0),
+	direction(1), last_throughput(0), window_start(0), window_finished_num(0) {}
+
+static double monotonic_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* the 4th field of /proc/loadavg is "runnable tasks/all tasks", counted right now */
+static bool read_runnable_num(size_t *runnable_num)
+{
+	FILE *loadavg = fopen("/proc/loadavg", "r");
+	if (!loadavg) return false;
+	unsigned long num = 0;
+	bool read = (fscanf(loadavg, "%*f %*f %*f %lu/", &num) == 1);
+	fclose(loadavg);
+	if (read) *runnable_num = num;
+	return read;
+}
+
+/* called each time a process finishes */
+void ProcessMultiplexer::adapt(size_t running_num)
+{
+	if (cpu_num == 0) return;
+	window_finished_num++;
+	double now = monotonic_time();
+	if (now - window_start < ADAPT_INTERVAL) return;
+	double throughput = window_finished_num / (now - window_start);
+	window_start = now;
+	window_finished_num = 0;
+	if (throughput < last_throughput * (1 - THROUGHPUT_TOLERANCE)) direction = -direction;
+	last_throughput = throughput;
+	size_t runnable_num = 0;
+	/* the runnable tasks are this thread, our processes and the others */
+	if (read_runnable_num(&runnable_num) && runnable_num > running_num + 1) {
+		size_t other_num = runnable_num - running_num - 1;
+		if (other_num >= cpu_num || process_num > cpu_num - other_num) {
+			direction = -1;
+			if (process_num > 1) process_num--;
+			return;
+		}
+	}
+	if ((direction < 0 && process_num == 1) || (direction > 0 && process_num == max_process_num)) {
+		direction = -direction;
+	}
+	process_num += direction;
+}
+
+static bool watch(int epfd, int fd, uint32_t events, uint64_t data)
+{
+	struct epoll_event event;
+	event.events = events;
+	event.data.u64 = data;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void finish(Process *process, ProcessRequest *request)
+{
+	/* the child has closed its stdout, so the rest of the input is never read */
+	if (process->in >= 0) {
+		close(process->in);
+		process->in = -1;
+	}
+	if (process->out >= 0) {
+		close(process->out);
+		process->out = -1;
+	}
+	request->output.swap(process->output);
+	request->succeeded = process->wait();
+	delete process;
+}
+
+void ProcessMultiplexer::run(const vector<ProcessRequest *> &requests)
+{
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		for (size_t i = 0; i < requests.size(); i++) {
+			ProcessRequest *request = requests.at(i);
+			request->succeeded = run_process(request->argv, request->input, &request->output);
+		}
+		return;
+	}
+	vector<Process *> processes(max_process_num, (Process *)NULL);
+	vector<ProcessRequest *> running_requests(max_process_num, (ProcessRequest *)NULL);
+	size_t next = 0;
+	size_t running_num = 0;
+	struct epoll_event events[MAX_EVENT_NUM];
+	window_start = monotonic_time();
+	while (next < requests.size() || running_num > 0) {
+		size_t slot = 0;
+		while (slot < max_process_num && running_num < process_num && next < requests.size()) {
+			if (processes.at(slot)) {
+				slot++;
+				continue;
+			}
+			ProcessRequest *request = requests.at(next++);
+			Process *process = new Process();
+			/* closing the pipes removes them from epoll, so they are never deleted by hand */
+			if (!process->spawn(request->argv, request->input) ||
+				!watch(epfd, process->out, EPOLLIN, slot << 1) ||
+				(process->in >= 0 && !watch(epfd, process->in, EPOLLOUT, (slot << 1) | INPUT_EVENT))) {
+				finish(process, request);
+				request->succeeded = false;
+				continue;
+			}
+			processes.at(slot) = process;
+			running_requests.at(slot) = request;
+			running_num++;
+		}
+		if (running_num == 0) continue;
+		int event_num = epoll_wait(epfd, events, MAX_EVENT_NUM, -1);
+		if (event_num < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		for (int i = 0; i < event_num; i++) {
+			size_t slot = events[i].data.u64 >> 1;
+			Process *process = processes.at(slot);
+			if (!process) continue;
+			if (events[i].data.u64 & INPUT_EVENT) {
+				process->write_input();
+			} else if (!process->read_output()) {
+				finish(process, running_requests.at(slot));
+				processes.at(slot) = NULL;
+				running_requests.at(slot) = NULL;
+				running_num--;
+				adapt(running_num);
+			}
+		}
+	}
+	for (size_t slot = 0; slot < max_process_num; slot++) {
+		if (processes.at(slot)) finish(processes.at(slot), running_requests.at(slot));
+	}
+	close(epfd);
+}
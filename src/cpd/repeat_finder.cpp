@@ -0,0 +1,123 @@
+#include <cpd/repeat_finder.hpp>
+#include <limits.h>
+#include <algorithm>
+
+#define LEFT_EMPTY -1 /* no suffix of the interval is seen yet */
+#define LEFT_MIXED -2 /* the suffixes of the interval follow different symbols */
+
+using namespace std;
+
+/* orders the suffixes by the ranks of their first k symbols and of the next k ones */
+class SuffixOrder {
+public:
+	const vector<long> *ranks;
+	size_t k;
+	SuffixOrder(const vector<long> *ranks_, size_t k_) : ranks(ranks_), k(k_) {}
+	long next_rank(size_t suffix) const {
+		return (suffix + k < ranks->size()) ? ranks->at(suffix + k) : LONG_MIN;
+	}
+	bool operator()(size_t a, size_t b) const {
+		if (ranks->at(a) != ranks->at(b)) return ranks->at(a) < ranks->at(b);
+		return next_rank(a) < next_rank(b);
+	}
+};
+
+/* prefix doubling: the suffixes are sorted by twice as many symbols in each round */
+void RepeatFinder::make_suffix_array(vector<size_t> *suffixes) const
+{
+	size_t n = symbols.size();
+	vector<long> ranks(symbols.begin(), symbols.end());
+	vector<long> next_ranks(n);
+	suffixes->resize(n);
+	for (size_t i = 0; i < n; i++) {
+		suffixes->at(i) = i;
+	}
+	for (size_t k = 1; n > 0; k *= 2) {
+		SuffixOrder order(&ranks, k);
+		sort(suffixes->begin(), suffixes->end(), order);
+		next_ranks.at(suffixes->at(0)) = 0;
+		for (size_t i = 1; i < n; i++) {
+			long rank = next_ranks.at(suffixes->at(i - 1));
+			next_ranks.at(suffixes->at(i)) = (order(suffixes->at(i - 1), suffixes->at(i))) ? rank + 1 : rank;
+		}
+		ranks.swap(next_ranks);
+		if (ranks.at(suffixes->at(n - 1)) == (long)n - 1 || k >= n) break;
+	}
+}
+
+/* lcps[i] is the length of the prefix shared by the suffixes i - 1 and i of the suffix array (Kasai et al.) */
+void RepeatFinder::make_lcp_array(const vector<size_t> &suffixes, vector<size_t> *lcps) const
+{
+	size_t n = symbols.size();
+	vector<size_t> ranks(n);
+	for (size_t i = 0; i < n; i++) {
+		ranks.at(suffixes.at(i)) = i;
+	}
+	lcps->assign(n, 0);
+	size_t lcp = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (ranks.at(i) == 0) {
+			lcp = 0;
+			continue;
+		}
+		size_t j = suffixes.at(ranks.at(i) - 1);
+		while (i + lcp < n && j + lcp < n && symbols.at(i + lcp) == symbols.at(j + lcp)) lcp++;
+		lcps->at(ranks.at(i)) = lcp;
+		if (lcp > 0) lcp--;
+	}
+}
+
+/* an lcp-interval of the suffix array, with the symbol before its suffixes if they all follow the same one */
+class LcpInterval {
+public:
+	long lcp;
+	size_t lb;
+	int left;
+	LcpInterval(long lcp_, size_t lb_, int left_) : lcp(lcp_), lb(lb_), left(left_) {}
+	void add_left(int another_left) {
+		if (left == LEFT_EMPTY) {
+			left = another_left;
+		} else if (left != another_left) {
+			left = LEFT_MIXED;
+		}
+	}
+};
+
+/*
+ * the lcp-intervals are the repeats which are maximal to the right, and they are walked bottom-up,
+ * so an interval knows the symbols before its suffixes from its children. a repeat which follows
+ * a separator (or the beginning) is maximal to the left, as no other occurrence follows the same one.
+ */
+void RepeatFinder::find(vector<Repeat> *repeats) const
+{
+	size_t n = symbols.size();
+	vector<size_t> suffixes;
+	vector<size_t> lcps;
+	make_suffix_array(&suffixes);
+	make_lcp_array(suffixes, &lcps);
+	vector<LcpInterval> intervals;
+	intervals.push_back(LcpInterval(0, 0, LEFT_EMPTY));
+	for (size_t i = 1; i <= n; i++) {
+		long lcp = (i < n) ? (long)lcps.at(i) : -1;
+		size_t suffix = suffixes.at(i - 1);
+		int left = (suffix == 0 || symbols.at(suffix - 1) < 0) ? LEFT_MIXED : symbols.at(suffix - 1);
+		if (lcp > intervals.back().lcp) {
+			intervals.push_back(LcpInterval(lcp, i - 1, left));
+			continue;
+		}
+		intervals.back().add_left(left);
+		while (!intervals.empty() && lcp < intervals.back().lcp) {
+			LcpInterval interval = intervals.back();
+			intervals.pop_back();
+			if (interval.lcp > 0 && interval.left == LEFT_MIXED) {
+				repeats->push_back(Repeat(interval.lcp));
+				repeats->back().positions.assign(suffixes.begin() + interval.lb, suffixes.begin() + i);
+			}
+			if (intervals.empty() || lcp > intervals.back().lcp) {
+				intervals.push_back(LcpInterval(lcp, interval.lb, interval.left));
+				break;
+			}
+			intervals.back().add_left(interval.left);
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#include <cpd/stmt_dictionary.hpp>
+
+using namespace std;
+
+StmtDictionary::StmtDictionary(void) : next_id(0)
+{
+	for (size_t i = 0; i < STMT_DICTIONARY_SHARD_NUM; i++) {
+		pthread_mutex_init(&shards[i].mutex, NULL);
+	}
+	pthread_mutex_init(&id_mutex, NULL);
+}
+
+StmtDictionary::~StmtDictionary(void)
+{
+	pthread_mutex_destroy(&id_mutex);
+	for (size_t i = 0; i < STMT_DICTIONARY_SHARD_NUM; i++) {
+		pthread_mutex_destroy(&shards[i].mutex);
+	}
+}
+
+uint32_t StmtDictionary::add(const StmtHash &hash)
+{
+	Shard &shard = shards[hash.bytes[0] & (STMT_DICTIONARY_SHARD_NUM - 1)];
+	pthread_mutex_lock(&shard.mutex);
+	StmtEntry &entry = shard.entries[hash];
+	if (entry.count == 0) {
+		pthread_mutex_lock(&id_mutex);
+		entry.id = next_id++;
+		pthread_mutex_unlock(&id_mutex);
+	}
+	entry.count++;
+	uint32_t id = entry.id;
+	pthread_mutex_unlock(&shard.mutex);
+	return id;
+}
+
+void StmtDictionary::get_counts(vector<uint32_t> *counts) const
+{
+	counts->assign(next_id, 0);
+	for (size_t i = 0; i < STMT_DICTIONARY_SHARD_NUM; i++) {
+		const map<StmtHash, StmtEntry, StmtHashOrder> &entries = shards[i].entries;
+		for (map<StmtHash, StmtEntry, StmtHashOrder>::const_iterator it = entries.begin(); it != entries.end(); it++) {
+			counts->at(it->second.id) = it->second.count;
+		}
+	}
+}
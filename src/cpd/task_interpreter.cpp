@@ -0,0 +1,99 @@
+#include <cpd/task_interpreter.hpp>
+#include <string.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "EXTERN.h"
+#include "perl.h"
+
+EXTERN_C void boot_DynaLoader(pTHX_ CV *cv);
+
+#ifdef __cplusplus
+};
+#endif
+
+#define PREPARER_MODULE "Compiler::Tools::CopyPasteDetector::TaskPreparer"
+#define EMBED_PROGRAM PREPARER_MODULE "::setup(@ARGV)"
+
+using namespace std;
+
+static void xs_init(pTHX)
+{
+	newXS((char *)"DynaLoader::boot_DynaLoader", boot_DynaLoader, (char *)__FILE__);
+}
+
+TaskInterpreter::TaskInterpreter(const vector<string> &args_, const vector<string> &options) :
+	perl(NULL), is_alive(false)
+{
+	vector<string> args;
+	args.push_back("perl");
+	args.insert(args.end(), args_.begin(), args_.end());
+	args.push_back("-M" PREPARER_MODULE);
+	args.push_back("-e");
+	args.push_back(EMBED_PROGRAM);
+	args.insert(args.end(), options.begin(), options.end());
+	vector<char *> argv;
+	for (size_t i = 0; i < args.size(); i++) {
+		argv.push_back((char *)args.at(i).c_str());
+	}
+	argv.push_back(NULL);
+
+	/* the interpreter of the caller is given back as DeparseInterpreter does */
+	PerlInterpreter *caller = (PerlInterpreter *)PERL_GET_CONTEXT;
+	PerlInterpreter *my_perl = perl_alloc();
+	if (!my_perl) return;
+	perl = my_perl;
+	PERL_SET_CONTEXT(my_perl);
+	perl_construct(my_perl);
+	PL_perl_destruct_level = 1;
+	PL_exit_flags |= PERL_EXIT_DESTRUCT_END;
+	is_alive = (perl_parse(my_perl, xs_init, (int)args.size(), &argv[0], NULL) == 0 && perl_run(my_perl) == 0);
+	PERL_SET_CONTEXT(caller);
+}
+
+TaskInterpreter::~TaskInterpreter(void)
+{
+	if (!perl) return;
+	PerlInterpreter *caller = (PerlInterpreter *)PERL_GET_CONTEXT;
+	PerlInterpreter *my_perl = perl;
+	PERL_SET_CONTEXT(my_perl);
+	perl_destruct(my_perl);
+	perl_free(my_perl);
+	PERL_SET_CONTEXT(caller);
+}
+
+bool TaskInterpreter::prepare(Task *task, TaskDecoder decode, string *error)
+{
+	if (!is_alive) {
+		*error = "can't start " PREPARER_MODULE;
+		return false;
+	}
+	PerlInterpreter *caller = (PerlInterpreter *)PERL_GET_CONTEXT;
+	PerlInterpreter *my_perl = perl;
+	PERL_SET_CONTEXT(my_perl);
+	bool prepared = false;
+	dSP;
+	ENTER;
+	SAVETMPS;
+	PUSHMARK(SP);
+	XPUSHs(sv_2mortal(newSVpv(task->filename, strlen(task->filename))));
+	PUTBACK;
+	int count = call_pv(PREPARER_MODULE "::prepare_task", G_SCALAR | G_EVAL);
+	SPAGAIN;
+	if (count == 1) {
+		SV *ret = POPs;
+		if (SvTRUE(ERRSV)) {
+			*error = SvPV_nolen(ERRSV);
+		} else if (SvROK(ret) && SvTYPE(SvRV(ret)) == SVt_PVHV) {
+			/* the task is copied before its strings are freed by FREETMPS */
+			decode(my_perl, (HV *)SvRV(ret), task);
+			prepared = true;
+		}
+	}
+	PUTBACK;
+	FREETMPS;
+	LEAVE;
+	PERL_SET_CONTEXT(caller);
+	if (!prepared && error->empty()) *error = string("can't prepare ") + task->filename;
+	return prepared;
+}
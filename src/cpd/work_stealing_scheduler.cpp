@@ -0,0 +1,107 @@
+#include <cpd/work_stealing_scheduler.hpp>
+#include <algorithm>
+
+using namespace std;
+
+/* orders the items of a task after the larger items of the same task */
+static bool is_larger(const WorkItem &item, const WorkItem &another_item)
+{
+	if (item.task_id != another_item.task_id) return item.task_id < another_item.task_id;
+	if (item.cost != another_item.cost) return item.cost > another_item.cost;
+	return item.stmt_id < another_item.stmt_id;
+}
+
+class TaskCost {
+public:
+	size_t task_id;
+	size_t cost;
+	size_t begin; /* index of the first item of the task */
+	size_t end;
+	TaskCost(size_t task_id_, size_t begin_) : task_id(task_id_), cost(0), begin(begin_), end(begin_) {}
+};
+
+static bool is_larger_task(const TaskCost &task, const TaskCost &another_task)
+{
+	if (task.cost != another_task.cost) return task.cost > another_task.cost;
+	return task.task_id < another_task.task_id;
+}
+
+WorkStealingScheduler::WorkStealingScheduler(size_t worker_num_, vector<WorkItem> items) :
+	worker_num((worker_num_ > 0) ? worker_num_ : 1)
+{
+	queues.resize(worker_num);
+	costs.resize(worker_num, 0);
+	mutexes = new pthread_mutex_t[worker_num];
+	for (size_t i = 0; i < worker_num; i++) {
+		pthread_mutex_init(&mutexes[i], NULL);
+	}
+	sort(items.begin(), items.end(), is_larger);
+	vector<TaskCost> tasks;
+	for (size_t i = 0; i < items.size(); i++) {
+		if (tasks.empty() || tasks.back().task_id != items.at(i).task_id) tasks.push_back(TaskCost(items.at(i).task_id, i));
+		tasks.back().cost += items.at(i).cost;
+		tasks.back().end = i + 1;
+	}
+	/* the largest task goes to the worker which has the least cost */
+	sort(tasks.begin(), tasks.end(), is_larger_task);
+	vector<size_t> dealt_costs(worker_num, 0);
+	for (size_t i = 0; i < tasks.size(); i++) {
+		size_t worker_id = min_element(dealt_costs.begin(), dealt_costs.end()) - dealt_costs.begin();
+		const TaskCost &task = tasks.at(i);
+		queues.at(worker_id).insert(queues.at(worker_id).end(), items.begin() + task.begin, items.begin() + task.end);
+		costs.at(worker_id) += task.cost;
+		/* a task of no cost still takes a turn */
+		dealt_costs.at(worker_id) += (task.cost > 0) ? task.cost : 1;
+	}
+}
+
+WorkStealingScheduler::~WorkStealingScheduler(void)
+{
+	for (size_t i = 0; i < worker_num; i++) {
+		pthread_mutex_destroy(&mutexes[i]);
+	}
+	delete[] mutexes;
+}
+
+bool WorkStealingScheduler::pop(size_t queue_id, bool steals, WorkItem *item)
+{
+	pthread_mutex_lock(&mutexes[queue_id]);
+	deque<WorkItem> &queue = queues.at(queue_id);
+	bool found = !queue.empty();
+	if (found && steals) {
+		*item = queue.back();
+		queue.pop_back();
+	} else if (found) {
+		*item = queue.front();
+		queue.pop_front();
+	}
+	if (found) costs.at(queue_id) -= item->cost;
+	pthread_mutex_unlock(&mutexes[queue_id]);
+	return found;
+}
+
+bool WorkStealingScheduler::next(size_t worker_id, WorkItem *item)
+{
+	size_t own_id = worker_id % worker_num;
+	if (pop(own_id, false, item)) return true;
+	for (;;) {
+		size_t victim_id = own_id;
+		size_t max_cost = 0;
+		bool has_items = false;
+		for (size_t i = 0; i < worker_num; i++) {
+			pthread_mutex_lock(&mutexes[i]);
+			bool is_empty = queues.at(i).empty();
+			size_t cost = costs.at(i);
+			pthread_mutex_unlock(&mutexes[i]);
+			if (is_empty) continue;
+			if (!has_items || cost > max_cost) {
+				victim_id = i;
+				max_cost = cost;
+			}
+			has_items = true;
+		}
+		if (!has_items) return false;
+		/* another thief may have emptied the victim in the meantime */
+		if (pop(victim_id, true, item)) return true;
+	}
+}
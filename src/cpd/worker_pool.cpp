@@ -0,0 +1,87 @@
+#include <cpd/worker_pool.hpp>
+
+using namespace std;
+
+/* the argument of a thread, freed by the thread */
+class Worker {
+public:
+	WorkerPool *pool;
+	size_t worker_id;
+	Worker(WorkerPool *pool_, size_t worker_id_) : pool(pool_), worker_id(worker_id_) {}
+};
+
+WorkerPool::WorkerPool(size_t worker_num_) :
+	worker_num(worker_num_), round(NULL), round_id(0), finished_num(0), is_stopped(false)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&round_started, NULL);
+	pthread_cond_init(&round_finished, NULL);
+	for (size_t i = 0; i < worker_num; i++) {
+		pthread_t thread;
+		Worker *worker = new Worker(this, i);
+		if (pthread_create(&thread, NULL, work, (void *)worker) != 0) {
+			delete worker;
+			break;
+		}
+		threads.push_back(thread);
+	}
+	/* a round is run by the threads which could start, or by the caller if none could (or were asked) */
+	worker_num = threads.size();
+}
+
+WorkerPool::~WorkerPool(void)
+{
+	pthread_mutex_lock(&mutex);
+	is_stopped = true;
+	pthread_cond_broadcast(&round_started);
+	pthread_mutex_unlock(&mutex);
+	for (size_t i = 0; i < threads.size(); i++) {
+		pthread_join(threads.at(i), NULL);
+	}
+	pthread_cond_destroy(&round_finished);
+	pthread_cond_destroy(&round_started);
+	pthread_mutex_destroy(&mutex);
+}
+
+void WorkerPool::run(WorkerRound *round_)
+{
+	if (worker_num == 0) {
+		round_->run(0);
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	round = round_;
+	finished_num = 0;
+	round_id++;
+	pthread_cond_broadcast(&round_started);
+	while (finished_num < worker_num) {
+		pthread_cond_wait(&round_finished, &mutex);
+	}
+	round = NULL;
+	pthread_mutex_unlock(&mutex);
+}
+
+void *WorkerPool::work(void *worker_)
+{
+	Worker *worker = (Worker *)worker_;
+	WorkerPool *pool = worker->pool;
+	size_t worker_id = worker->worker_id;
+	delete worker;
+	size_t last_round_id = 0;
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->is_stopped && pool->round_id == last_round_id) {
+			pthread_cond_wait(&pool->round_started, &pool->mutex);
+		}
+		if (pool->is_stopped) break;
+		last_round_id = pool->round_id;
+		WorkerRound *round = pool->round;
+		pthread_mutex_unlock(&pool->mutex);
+		round->run(worker_id);
+		pthread_mutex_lock(&pool->mutex);
+		pool->finished_num++;
+		pthread_cond_signal(&pool->round_finished);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
@@ -0,0 +1,179 @@
+#include <cpd/zygote.hpp>
+#include <cpd/process.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define ZYGOTE_BACKLOG 128
+#define ZYGOTE_CONTROL_FD 3
+
+using namespace std;
+
+/* returns 0 if path doesn't fit in sun_path */
+static socklen_t make_address(const string &path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr->sun_path)) return 0;
+	memcpy(addr->sun_path, path.data(), path.size());
+	return offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+}
+
+/* the private directory of a socket, or an empty string */
+static string make_socket_dir(void)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	string path = string((tmpdir && *tmpdir) ? tmpdir : "/tmp") + "/cpd-zygote-XXXXXX";
+	vector<char> buf(path.begin(), path.end());
+	buf.push_back('\0');
+	if (!mkdtemp(&buf[0])) {
+		perror("mkdtemp");
+		return "";
+	}
+	return string(&buf[0]);
+}
+
+Zygote::Zygote(const vector<string> &argv_, size_t max_child_num) :
+	argv(argv_), pid(-1), control(-1), is_alive(false)
+{
+	dir = make_socket_dir();
+	if (dir.empty()) return;
+	address = dir + "/socket";
+	struct sockaddr_un addr;
+	socklen_t addr_len = make_address(address, &addr);
+	if (addr_len == 0) {
+		fprintf(stderr, "zygote: socket path is too long: %s\n", address.c_str());
+		return;
+	}
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0) return;
+	int pipe_fds[2];
+	/* the statements of a zygote which can't start are deparsed by the process, which is much slower */
+	if (bind(listener, (struct sockaddr *)&addr, addr_len) < 0 ||
+		listen(listener, ZYGOTE_BACKLOG) < 0 || pipe2(pipe_fds, O_CLOEXEC) < 0) {
+		fprintf(stderr, "zygote: can't listen on %s: %s\n", address.c_str(), strerror(errno));
+		close(listener);
+		return;
+	}
+	char child_num[32] = {0};
+	snprintf(child_num, sizeof(child_num), "%lu", (unsigned long)max_child_num);
+	/* the perl of argv runs Zygote::run by -e, which takes the number from @ARGV */
+	vector<string> zygote_argv = argv;
+	zygote_argv.push_back(child_num);
+	vector<int> fds(ZYGOTE_CONTROL_FD + 1, -1);
+	fds.at(0) = listener;
+	fds.at(ZYGOTE_CONTROL_FD) = pipe_fds[0];
+	pid = spawn_process(zygote_argv, fds);
+	/* connections are queued by the socket until the zygote has loaded the modules */
+	close(listener);
+	close(pipe_fds[0]);
+	if (pid < 0) {
+		fprintf(stderr, "zygote: can't spawn %s\n", argv.at(0).c_str());
+		close(pipe_fds[1]);
+		return;
+	}
+	control = pipe_fds[1];
+	is_alive = true;
+}
+
+Zygote::~Zygote(void)
+{
+	if (control >= 0) close(control);
+	if (pid > 0) {
+		while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+	}
+	if (!address.empty()) unlink(address.c_str());
+	if (!dir.empty()) rmdir(dir.c_str());
+}
+
+int Zygote::connect(void) const
+{
+	if (!is_alive) return -1;
+	struct sockaddr_un addr;
+	socklen_t addr_len = make_address(address, &addr);
+	if (addr_len == 0) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	if (::connect(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+ZygoteRegistry::ZygoteRegistry(size_t max_child_num_) : max_child_num(max_child_num_)
+{
+	pthread_mutex_init(&mutex, NULL);
+}
+
+ZygoteRegistry::~ZygoteRegistry(void)
+{
+	for (map<vector<string>, Zygote *>::iterator it = zygotes.begin(); it != zygotes.end(); it++) {
+		delete it->second;
+	}
+	pthread_mutex_destroy(&mutex);
+}
+
+const Zygote *ZygoteRegistry::get(const vector<string> &argv)
+{
+	pthread_mutex_lock(&mutex);
+	map<vector<string>, Zygote *>::iterator it = zygotes.find(argv);
+	Zygote *zygote;
+	if (it != zygotes.end()) {
+		zygote = it->second;
+	} else {
+		zygote = new Zygote(argv, max_child_num);
+		zygotes.insert(make_pair(argv, zygote));
+	}
+	pthread_mutex_unlock(&mutex);
+	return zygote;
+}
+
+ZygoteDeparser::ZygoteDeparser(ZygoteRegistry *registry_, size_t batch_size_, size_t max_child_num_) :
+	registry(registry_), batch_size(batch_size_), max_child_num(max_child_num_) {}
+
+ZygoteDeparser::~ZygoteDeparser(void)
+{
+	for (size_t i = 0; i < children.size(); i++) {
+		delete children.at(i).server;
+	}
+}
+
+DeparseServer *ZygoteDeparser::get(const vector<string> &argv)
+{
+	for (size_t i = 0; i < children.size(); i++) {
+		if (children.at(i).argv != argv) continue;
+		ZygoteChild child = children.at(i);
+		children.erase(children.begin() + i);
+		if (child.deparsed_num >= batch_size) {
+			/* the next batch is deparsed by a fresh child */
+			delete child.server;
+			break;
+		}
+		child.deparsed_num++;
+		children.push_back(child);
+		return child.server;
+	}
+	if (children.size() >= max_child_num) {
+		delete children.front().server;
+		children.erase(children.begin());
+	}
+	/* a dead child or zygote is kept, so its statements just fall back to the process */
+	ZygoteChild child(argv, new DeparseServer(registry->get(argv)->connect()));
+	child.deparsed_num++;
+	children.push_back(child);
+	return child.server;
+}
+
+bool ZygoteDeparser::deparse(const DeparseCommand *cmd, const char *src, string *code)
+{
+	if (cmd->zygote_argv.empty()) return false;
+	return get(cmd->zygote_argv)->deparse(src, code);
+}
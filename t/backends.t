@@ -0,0 +1,115 @@
+use strict;
+use warnings;
+use File::Basename;
+use File::Copy;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+# each deparser, scheduler and jobs of the engine gives the records of the embedded deparser
+my $test_src_dir = File::Spec->catfile(dirname(__FILE__), 'test_src');
+my $temp_dir     = File::Temp::tempdir( CLEANUP => 1);
+my @files = map { File::Spec->catfile($test_src_dir, $_) } qw(a.pl b.pl c.pl);
+
+# the hash of each record as 'file:start-end'
+sub hashes {
+    my ($options, $files) = @_;
+    my $detector = Compiler::Tools::CopyPasteDetector->new({ output_dirname => $temp_dir, jobs => 2, %$options });
+    return { map {
+        (basename($_->{file}) . ":$_->{start_line}-$_->{end_line}" => $_->{hash})
+    } @{$detector->detect($files || \@files)} };
+}
+
+my $expected = hashes({ deparser => 'embedded' });
+ok(scalar keys %$expected, 'detects records');
+
+subtest 'server' => sub {
+    is_deeply(hashes({ deparser => 'server' }), $expected, 'deparse servers');
+};
+
+subtest 'embedded' => sub {
+    # each worker thread owns its interpreters
+    is_deeply(hashes({ deparser => 'embedded', jobs => 1 }), $expected, 'one worker');
+    is_deeply(hashes({ deparser => 'embedded', jobs => 3 }), $expected, 'three workers');
+};
+
+subtest 'zygote' => sub {
+    is_deeply(hashes({ deparser => 'zygote' }), $expected, 'children forked by zygotes');
+};
+
+subtest 'process' => sub {
+    is_deeply(hashes({ deparser => 'process' }), $expected, 'a process for each statement');
+};
+
+subtest 'event' => sub {
+    is_deeply(hashes({ deparser => 'process', scheduler => 'event' }), $expected, 'processes in flight');
+    is_deeply(hashes({ deparser => 'process', scheduler => 'event', deparse_unit => 'file' }),
+              hashes({ deparser => 'process', deparse_unit => 'file' }), 'and files deparsed at once');
+};
+
+subtest 'fingerprint' => sub {
+    # the op trees give other hashes (see t/fingerprint.t), but the same records
+    is_deeply([ sort keys %{hashes({ deparser => 'fingerprint' })} ], [ sort keys %$expected ], 'the same records');
+};
+
+subtest 'lexical' => sub {
+    # the tokens give other hashes (see t/lexical.t), and the pragmas are no empty statements
+    my $lexical = hashes({ deparser => 'lexical' });
+    is_deeply([ grep { !exists $lexical->{$_} } sort keys %$expected ], [], 'the records and more');
+};
+
+subtest 'work stealing' => sub {
+    # the statements of a file are stolen by the other workers
+    is_deeply(hashes({ deparser => 'process', jobs => 1 }), $expected, 'one worker');
+    is_deeply(hashes({ deparser => 'process', jobs => 4 }), $expected, 'four workers');
+};
+
+subtest 'auto jobs' => sub {
+    is_deeply(hashes({ deparser => 'embedded', jobs => 'auto' }), $expected, 'the workers of the CPUs');
+    is_deeply(hashes({ deparser => 'process', scheduler => 'event', jobs => 'auto' }), $expected,
+              'the processes in flight adapted');
+};
+
+subtest 'stream' => sub {
+    # the files are detected by more windows than one, but their records don't depend on them
+    my @copies;
+    foreach my $i (1 .. 12) {
+        foreach my $file (@files) {
+            my $copy = File::Spec->catfile($temp_dir, "$i-" . basename($file));
+            copy($file, $copy) or die "$copy: $!";
+            push(@copies, $copy);
+        }
+    }
+    my $hashes = hashes({ deparser => 'embedded' }, \@copies);
+    foreach my $i (1, 12) {
+        is_deeply({ map { /^$i-(.*)$/ ? ($1 => $hashes->{$_}) : () } keys %$hashes }, $expected, "copy $i");
+    }
+};
+
+subtest 'lexed by the workers' => sub {
+    # the workers lex the files by the options the detector lexes a script by
+    my $options = { output_dirname => $temp_dir, prefilter => 1, ignore_variable_name => 1 };
+    my $detector = Compiler::Tools::CopyPasteDetector->new($options);
+    my $records = $detector->detect([ $files[0] ]);
+    my $stmts = Compiler::Tools::CopyPasteDetector->new($options)->__get_stmt_data($files[0]);
+    ok(scalar @$records, 'detects records');
+    is_deeply([ sort map { "$_->{start_line}-$_->{end_line} $_->{hash}" } @$records ],
+              [ sort map { "$_->{start_line}-$_->{end_line} $_->{hash}" } @$stmts ], 'the records of the script');
+};
+
+subtest 'suffix_array' => sub {
+    # the statements are interned into the dictionary by all the workers at once
+    my $hashes = hashes({ deparser => 'embedded', matcher => 'suffix_array' });
+    ok(scalar keys %$hashes, 'detects repeats');
+    is_deeply({ map { ($_ => $expected->{$_}) } keys %$hashes }, $hashes, 'records of the window matcher');
+    is_deeply(hashes({ deparser => 'embedded', matcher => 'suffix_array', jobs => 4 }), $hashes, 'by four workers');
+};
+
+subtest 'block' => sub {
+    my $hashes = hashes({ deparser => 'embedded', matcher => 'block' });
+    ok(scalar keys %$hashes, 'detects blocks');
+    is_deeply({ map { ($_ => $expected->{$_}) } keys %$hashes }, $hashes, 'records of the window matcher');
+};
+
+done_testing;
@@ -0,0 +1,76 @@
+use strict;
+use warnings;
+use File::Basename;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+# the block matcher hashes each block from its statements, and reports whole statements and blocks only
+my $temp_dir = File::Temp::tempdir( CLEANUP => 1);
+
+sub write_file {
+    my ($name, $op) = @_;
+    my $file = File::Spec->catfile($temp_dir, "$name.pl");
+    open(my $fh, '>', $file) or die "$file: $!";
+    print $fh <<"EOS";
+use strict;
+use warnings;
+
+my (\$x, \$y) = (3, 4);
+foreach my \$i (1 .. 3) {
+    my \$sum = \$x + \$i;
+    my \$diff = \$x - \$i;
+    my \$prod = \$y $op \$i;
+    print "\$sum \$diff \$prod\\n";
+}
+my \$unique_$name = "$name";
+my \$p = \$x * 2;
+my \$q = \$y * 2;
+EOS
+    close($fh);
+    return $file;
+}
+
+# the clone sets as sorted 'file:start-end file:start-end...'
+sub clone_sets {
+    my ($files) = @_;
+    my $detector = Compiler::Tools::CopyPasteDetector->new({
+        output_dirname => $temp_dir,
+        matcher        => 'block',
+        min_line_num   => 1,
+        min_token_num  => 1,
+    });
+    my $score = $detector->get_score($detector->detect($files));
+    return [ sort map {
+        join(' ', sort map { basename($_->{file}) . ":$_->{start_line}-$_->{end_line}" } @{$_->{set}});
+    } @{$score->{clone_set_score}} ];
+}
+
+my $a_file = write_file('a', '*');
+my $b_file = write_file('b', '*');
+my $c_file = write_file('c', '/');
+
+subtest 'whole block' => sub {
+    my $clone_sets = clone_sets([ $a_file, $b_file ]);
+    ok((grep { $_ eq 'a.pl:5-10 b.pl:5-10' } @$clone_sets), 'reports the foreach block')
+        or diag explain $clone_sets;
+    ok(!(grep { /a\.pl:(6|7|8|9)-/ } @$clone_sets), 'not the statements in it again')
+        or diag explain $clone_sets;
+    ok(!(grep { /a\.pl:12-13/ } @$clone_sets), 'nor the run of the statements after it')
+        or diag explain $clone_sets;
+    ok((grep { $_ eq 'a.pl:12-12 b.pl:12-12' } @$clone_sets), 'but each of them')
+        or diag explain $clone_sets;
+};
+
+subtest 'changed block' => sub {
+    my $clone_sets = clone_sets([ $a_file, $c_file ]);
+    ok(!(grep { /a\.pl:5-10/ } @$clone_sets), 'a statement changed in the block changes its hash')
+        or diag explain $clone_sets;
+    ok((grep { $_ eq 'a.pl:6-6 c.pl:6-6' } @$clone_sets), 'so the statements alike in it are reported')
+        or diag explain $clone_sets;
+    ok(!(grep { /a\.pl:8-8/ } @$clone_sets), 'but not the changed one')
+        or diag explain $clone_sets;
+};
+
+done_testing;
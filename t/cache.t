@@ -0,0 +1,55 @@
+use strict;
+use warnings;
+use File::Basename;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+my $test_src_dir = File::Spec->catfile(dirname(__FILE__), 'test_src');
+my $temp_dir     = File::Temp::tempdir( CLEANUP => 1);
+my $cache_dir    = File::Spec->catfile($temp_dir, 'cache');
+
+sub describe_records {
+    my ($records) = @_;
+    return [ sort map { join(' ', basename($_->{file}), "$_->{start_line}-$_->{end_line}", $_->{hash}) } @$records ];
+}
+
+my $detector = Compiler::Tools::CopyPasteDetector->new({
+    output_dirname => $temp_dir,
+    cache_dir      => $cache_dir,
+    jobs           => 2,
+});
+my $files = $detector->get_target_files_by_project_root($test_src_dir);
+my $first = describe_records($detector->detect($files));
+is($detector->engine->cache_hit_num, 0, 'the first detection deparses everything');
+ok(-f File::Spec->catfile($cache_dir, 'index'), 'commits the index');
+
+my $second = describe_records($detector->detect($files));
+my $hit_num = $detector->engine->cache_hit_num;
+ok($hit_num > 0, "the next detection of the engine hits the cache ($hit_num)");
+is_deeply($second, $first, 'with the same records');
+
+# another engine loads the cache committed by the first one
+my $other = Compiler::Tools::CopyPasteDetector->new({
+    output_dirname => $temp_dir,
+    cache_dir      => $cache_dir,
+    jobs           => 2,
+});
+is_deeply(describe_records($other->detect($files)), $first, 'another engine finds the same records');
+is($other->engine->cache_hit_num, $hit_num, 'from the cache');
+
+# a cache over its size is compacted into a data file of its own
+my $small = Compiler::Tools::CopyPasteDetector->new({
+    output_dirname => $temp_dir,
+    cache_dir      => $cache_dir,
+    cache_size     => 1024,
+    jobs           => 2,
+});
+is_deeply(describe_records($small->detect($files)), $first, 'a compacted cache finds the same records');
+is_deeply(describe_records($small->detect($files)), $first, 'and the next detection too');
+ok($small->engine->cache_hit_num > 0, 'from the compacted cache');
+my @data_files = glob(File::Spec->catfile($cache_dir, 'data.*'));
+is(scalar @data_files, 1, 'the replaced data file is removed') or diag explain \@data_files;
+
+done_testing;
@@ -0,0 +1,35 @@
+use strict;
+use warnings;
+use File::Basename;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+# deparse_unit 'file' maps the statements of the whole file deparsed at once by their '#line' markers,
+# which gives the hashes of the statements deparsed one by one
+my $test_src_dir = File::Spec->catfile(dirname(__FILE__), 'test_src');
+my $temp_dir     = File::Temp::tempdir( CLEANUP => 1);
+my @files = map { File::Spec->catfile($test_src_dir, $_) } qw(a.pl b.pl c.pl);
+
+# the hash of each record as 'file:start-end'
+sub hashes {
+    my ($deparse_unit) = @_;
+    my $detector = Compiler::Tools::CopyPasteDetector->new({
+        output_dirname => $temp_dir,
+        deparse_unit   => $deparse_unit,
+        jobs           => 2,
+    });
+    return { map { (basename($_->{file}) . ":$_->{start_line}-$_->{end_line}" => $_->{hash}) } @{$detector->detect(\@files)} };
+}
+
+my $stmt = hashes('stmt');
+my $file = hashes('file');
+is_deeply([ sort keys %$file ], [ sort keys %$stmt ], 'the same records');
+# a statement is deparsed from its tokens joined by spaces, so the regexp of a.pl:8-10 is '/ some /'
+# by 'stmt', while 'file' deparses it as it is written. the records including it differ only
+my @differing = grep { !defined $file->{$_} || $file->{$_} ne $stmt->{$_} } sort keys %$stmt;
+is_deeply(\@differing, [ grep { /^a\.pl:(\d+)-(\d+)$/ && $1 <= 8 && $2 >= 10 } sort keys %$stmt ], 'the same hashes but the regexp')
+    or diag explain \@differing;
+
+done_testing;
@@ -0,0 +1,32 @@
+# compiles statements without pragmas like the '-e' program of the deparse command
+my $compile = sub { eval $_[0] };
+
+use strict;
+use warnings;
+
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector::Deparser;
+
+my @stmts = (
+    q{ my $self = shift ;},
+    q{ my ( $a , $b ) = @_ ;},
+    q{ foo ( shift , 1 ) ;},
+    q{ return $self -> iowatcher -> recurring ( $after => sub { $self -> $cb ( pop ) } ) ;},
+    q{ my %h = ( a => 1 , b => [ 1 , 2 ] ) ;},
+    q{ print "done\n" if $sum ;},
+    q{ 1 ;},
+    q{ ;},
+);
+foreach my $src (@stmts) {
+    (my $quoted = $src) =~ s/'/'\\''/g;
+    my $expected = `$^X -MO=Deparse -e '$quoted' 2> /dev/null`;
+    my $code = Compiler::Tools::CopyPasteDetector::Deparser::deparse_stmt($compile, $src);
+    is $code, $expected, "deparse_stmt: $src";
+}
+
+foreach my $src (q{ use POSIX qw(floor) ;}, q{ sub foo { 1 } ;}, q{ my @f = glob ( '*' ) ;}, q{ my $x = ;}) {
+    is Compiler::Tools::CopyPasteDetector::Deparser::deparse_stmt($compile, $src), undef,
+        "deparse_stmt falls back to perl -MO=Deparse: $src";
+}
+
+done_testing;
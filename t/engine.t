@@ -0,0 +1,57 @@
+use strict;
+use warnings;
+use File::Basename;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+# the engines keep no state in the process, so several of them detect alike side by side
+my $test_src_dir = File::Spec->catfile(dirname(__FILE__), 'test_src');
+my $temp_dir     = File::Temp::tempdir( CLEANUP => 1);
+my @files = map { File::Spec->catfile($test_src_dir, $_) } qw(a.pl b.pl c.pl);
+
+# the records as sorted 'file start-end hash'
+sub records {
+    my ($records) = @_;
+    return [ sort map { join(' ', basename($_->{file}), "$_->{start_line}-$_->{end_line}", $_->{hash}) } @$records ];
+}
+
+sub detector {
+    my ($options) = @_;
+    return Compiler::Tools::CopyPasteDetector->new({ output_dirname => $temp_dir, jobs => 2, %$options });
+}
+
+my $expected = records(detector({})->detect(\@files));
+ok(scalar @$expected, 'detects records');
+
+subtest 'concurrent engines' => sub {
+    my $embedded = detector({});
+    my $server   = detector({ deparser => 'server' });
+    my $lexical  = detector({ deparser => 'lexical' });
+    my $lexical_expected = records($lexical->detect(\@files));
+    isnt($embedded->engine, $server->engine, 'each detector has an engine of its own');
+    # the detections interleave, each engine keeping its own workers and results
+    foreach my $round (1 .. 2) {
+        is_deeply(records($embedded->detect(\@files)), $expected, "embedded round $round");
+        is_deeply(records($lexical->detect(\@files)), $lexical_expected, "lexical round $round");
+        is_deeply(records($server->detect(\@files)), $expected, "server round $round");
+    }
+};
+
+subtest 'engine reuse' => sub {
+    my $first  = detector({});
+    my $engine = $first->engine;
+    is_deeply(records($first->detect(\@files)), $expected, 'first detector');
+    my $second = detector({ engine => $engine });
+    is($second->engine, $engine, 'the next detector takes the engine');
+    is_deeply(records($second->detect(\@files)), $expected, 'and detects alike by its warm workers');
+    my $other = detector({ engine => $engine, deparser => 'lexical' });
+    eval { $other->detect(\@files) };
+    like($@, qr/the engine was made with other options than the detector's/, 'dies on other options');
+    my $more_jobs = detector({ engine => $engine, jobs => 3 });
+    eval { $more_jobs->detect(\@files) };
+    like($@, qr/the engine was made with other options than the detector's/, 'dies on other jobs');
+};
+
+done_testing;
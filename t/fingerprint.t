@@ -0,0 +1,48 @@
+use strict;
+use warnings;
+use File::Basename;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+# the fingerprint deparser compares the op trees of the statements, not the codes B::Deparse prints
+my $test_src_dir = File::Spec->catfile(dirname(__FILE__), 'test_src');
+my $temp_dir     = File::Temp::tempdir( CLEANUP => 1);
+
+my $loops = File::Spec->catfile($temp_dir, 'loops.pl');
+open(my $fh, '>', $loops) or die "$loops: $!";
+print $fh <<'EOS';
+my @a = (1, 2, 3);
+for my $i (@a) {
+    print $i;
+}
+foreach my $i (@a) {
+    print $i;
+}
+EOS
+close($fh);
+
+# the hash of the record of each statement as 'file:start-end'
+sub hashes {
+    my ($deparser, $files) = @_;
+    my $detector = Compiler::Tools::CopyPasteDetector->new({
+        output_dirname => $temp_dir,
+        deparser       => $deparser,
+    });
+    return { map { (basename($_->{file}) . ":$_->{start_line}-$_->{end_line}" => $_->{hash}) } @{$detector->detect($files)} };
+}
+
+my $c = File::Spec->catfile($test_src_dir, 'c.pl');
+my $deparsed = hashes('process', [ $c, $loops ]);
+my $fingerprinted = hashes('fingerprint', [ $c, $loops ]);
+foreach my $clone (qw(c.pl:7-12 c.pl:18-23 c.pl:8-11 c.pl:19-22 loops.pl:2-4 loops.pl:5-7)) {
+    ok(defined $deparsed->{$clone} && defined $fingerprinted->{$clone}, "records $clone");
+}
+is($deparsed->{'c.pl:7-12'}, $deparsed->{'c.pl:18-23'}, 'B::Deparse prints unless and if ! alike');
+isnt($fingerprinted->{'c.pl:7-12'}, $fingerprinted->{'c.pl:18-23'}, 'but their op trees differ');
+is($fingerprinted->{'c.pl:8-11'}, $fingerprinted->{'c.pl:19-22'}, 'the statements in them are alike');
+is($fingerprinted->{'loops.pl:2-4'}, $fingerprinted->{'loops.pl:5-7'}, 'for and foreach have the same op tree');
+is($deparsed->{'loops.pl:2-4'}, $deparsed->{'loops.pl:5-7'}, 'and B::Deparse prints them alike');
+
+done_testing;
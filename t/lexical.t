@@ -0,0 +1,53 @@
+use strict;
+use warnings;
+use File::Temp;
+use File::Spec;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+# the lexical deparser compares the tokens of the statements, so their spaces and comments don't matter
+my $temp_dir = File::Temp::tempdir( CLEANUP => 1);
+my $file     = File::Spec->catfile($temp_dir, 'lexical.pl');
+open(my $fh, '>', $file) or die "$file: $!";
+print $fh <<'EOS';
+my $x = 1;
+my $total = $x + 10;
+my $total = $x
+    + 10; # the same tokens
+my $total = $x + 20;
+print "one";
+print "two";
+my $total = $x - 10;
+EOS
+close($fh);
+
+# the hash of the record of each statement as 'start-end'
+sub hashes {
+    my ($ignore_literal) = @_;
+    my $detector = Compiler::Tools::CopyPasteDetector->new({
+        output_dirname => $temp_dir,
+        deparser       => 'lexical',
+        ignore_literal => $ignore_literal,
+    });
+    my $hashes = { map { ("$_->{start_line}-$_->{end_line}" => $_->{hash}) } @{$detector->detect([ $file ])} };
+    ok(defined $hashes->{$_}, "records $_") foreach (qw(2-2 3-4 5-5 6-6 7-7 8-8));
+    return $hashes;
+}
+
+subtest 'tokens' => sub {
+    my $hashes = hashes(0);
+    is($hashes->{'2-2'}, $hashes->{'3-4'}, 'spaces and comments are ignored');
+    isnt($hashes->{'2-2'}, $hashes->{'5-5'}, 'the literals are compared');
+    isnt($hashes->{'6-6'}, $hashes->{'7-7'}, 'so are the strings');
+    isnt($hashes->{'2-2'}, $hashes->{'8-8'}, 'and the operators');
+};
+
+subtest 'ignore_literal' => sub {
+    my $hashes = hashes(1);
+    is($hashes->{'2-2'}, $hashes->{'3-4'}, 'spaces and comments are ignored');
+    is($hashes->{'2-2'}, $hashes->{'5-5'}, 'the literals are ignored');
+    is($hashes->{'6-6'}, $hashes->{'7-7'}, 'so are the strings');
+    isnt($hashes->{'2-2'}, $hashes->{'8-8'}, 'but not the operators');
+};
+
+done_testing;
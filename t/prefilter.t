@@ -0,0 +1,44 @@
+use strict;
+use warnings;
+use File::Basename;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+my $test_src_dir = File::Spec->catfile(dirname(__FILE__), 'test_src');
+my $temp_dir     = File::Temp::tempdir( CLEANUP => 1);
+
+# the records and the clone sets as sorted 'file:start-end' of their clones
+sub detect {
+    my ($prefilter) = @_;
+    my $detector = Compiler::Tools::CopyPasteDetector->new({
+        output_dirname => $temp_dir,
+        prefilter      => $prefilter,
+    });
+    my $files = $detector->get_target_files_by_project_root($test_src_dir);
+    my $records = $detector->detect($files);
+    my %counts;
+    $counts{$_->{hash}}++ foreach (@$records);
+    # the records which may be clones, with their parents which may be clones too
+    my @repeated_records = sort map {
+        join(' ', basename($_->{file}) . ":$_->{start_line}-$_->{end_line}", unpack('H*', $_->{hash}),
+             sort map { unpack('H*', $_) } grep { ($counts{$_} || 0) > 1 } @{$_->{parents}});
+    } grep { $counts{$_->{hash}} > 1 } @$records;
+    my $score = $detector->get_score($records);
+    my @sets = map {
+        join(' ', sort map { basename($_->{file}) . ":$_->{start_line}-$_->{end_line}" } @{$_->{set}});
+    } @{$score->{clone_set_score}};
+    return { record_num => scalar @$records, repeated_records => \@repeated_records, clone_sets => [ sort @sets ] };
+}
+
+my $all      = detect(0);
+my $filtered = detect(1);
+ok(scalar @{$all->{clone_sets}}, 'finds clones') or diag explain $all->{clone_sets};
+ok((grep { /c\.pl:\d+-\d+ c\.pl:\d+-\d+/ } @{$all->{clone_sets}}), 'unless and if ! are clones');
+is_deeply($filtered->{clone_sets}, $all->{clone_sets}, 'prefilter keeps the clone sets');
+is_deeply($filtered->{repeated_records}, $all->{repeated_records}, 'and the records which may be clones');
+ok($filtered->{record_num} <= $all->{record_num}, 'the unique statements are no records')
+    or diag "$filtered->{record_num} records with prefilter, $all->{record_num} without";
+
+done_testing;
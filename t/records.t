@@ -0,0 +1,46 @@
+use strict;
+use warnings;
+use File::Basename;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+# records.expected is the records of t/test_src detected by get_deparsed_stmts_by_xs_parallel of 0.01,
+# with the last statement of each file, which 0.01 lost by taking av_len for the number of the statements.
+# a hash is named by the first record having it, so the records are compared without their hashes
+my $test_src_dir  = File::Spec->catfile(dirname(__FILE__), 'test_src');
+my $expected_file = File::Spec->catfile(dirname(__FILE__), 'records.expected');
+my $temp_dir      = File::Temp::tempdir( CLEANUP => 1);
+
+sub describe_records {
+    my ($records) = @_;
+    my %names;
+    foreach my $record (sort {
+        $a->{file} cmp $b->{file} || $a->{start_line} <=> $b->{start_line} || $a->{end_line} <=> $b->{end_line}
+    } @$records) {
+        next if (exists $names{$record->{hash}});
+        $names{$record->{hash}} = basename($record->{file}) . ":$record->{start_line}-$record->{end_line}";
+    }
+    return [ sort map {
+        my $record = $_;
+        join(' ', basename($record->{file}), "$record->{start_line}-$record->{end_line}",
+             "lines=$record->{lines}", "tokens=$record->{token_num}", "hash=$names{$record->{hash}}",
+             'parents=' . join(',', sort map { (exists $names{$_}) ? $names{$_} : '?' } @{$record->{parents}}));
+    } @$records ];
+}
+
+open(my $fh, '<', $expected_file) or die "$expected_file: $!";
+chomp(my @expected = <$fh>);
+close($fh);
+
+foreach my $jobs (1, 2) {
+    my $detector = Compiler::Tools::CopyPasteDetector->new({ output_dirname => $temp_dir, jobs => $jobs });
+    my $files = $detector->get_target_files_by_project_root($test_src_dir);
+    my $records = $detector->detect($files);
+    is_deeply(describe_records($records), \@expected, "records and their parents (jobs => $jobs)");
+    ok((grep { basename($_->{file}) eq 'a.pl' && $_->{start_line} == 36 && $_->{end_line} == 36 } @$records),
+       "the last statement of a.pl (jobs => $jobs)");
+}
+
+done_testing;
@@ -0,0 +1,64 @@
+use strict;
+use warnings;
+use File::Spec;
+use File::Temp;
+use Test::More 0.96;
+use Compiler::Tools::CopyPasteDetector;
+
+# the maximal repeats as sorted 'length:position,position...'
+sub repeats {
+    my ($symbols) = @_;
+    my $repeats = Compiler::Tools::CopyPasteDetector::get_maximal_repeats_by_xs($symbols);
+    return [ sort map { "$_->[0]:" . join(',', @{$_->[1]}) } @$repeats ];
+}
+
+subtest 'left extendable' => sub {
+    # 2 3 is always after 1, so only 1 2 3 is maximal
+    is_deeply(repeats([1, 2, 3, 4, 1, 2, 3, 5]), ['3:0,4']);
+    # 2 3 is also after 6 once, so it has an occurrence of its own
+    is_deeply(repeats([1, 2, 3, 4, 1, 2, 3, 6, 2, 3]), ['2:1,5,8', '3:0,4']);
+};
+
+subtest 'separator boundary' => sub {
+    # a run doesn't cross a separator, though the symbols around it are repeated
+    is_deeply(repeats([7, 8, -1, 7, 8, -1, 7, 8]), ['2:0,3,6']);
+    is_deeply(repeats([1, -1, 2, 1, -1, 2]), ['1:0,3', '1:2,5']);
+};
+
+subtest 'nested block' => sub {
+    my $temp_dir = File::Temp::tempdir(CLEANUP => 1);
+    my @files;
+    for my $name (qw(a b)) {
+        my $file = File::Spec->catfile($temp_dir, "$name.pl");
+        open(my $fh, '>', $file) or die "$file: $!";
+        print $fh <<"EOS";
+use strict;
+use warnings;
+
+my (\$x, \$y) = (3, 4);
+foreach my \$i (1 .. 3) {
+    my \$sum = \$x + \$i;
+    my \$diff = \$x - \$i;
+    my \$prod = \$y * \$i;
+    print "\$sum \$diff \$prod\\n";
+}
+my \$unique_$name = "$name";
+EOS
+        close($fh);
+        push(@files, $file);
+    }
+    my $detector = Compiler::Tools::CopyPasteDetector->new({
+        output_dirname => $temp_dir,
+        matcher        => 'suffix_array',
+        min_line_num   => 1,
+        min_token_num  => 1,
+    });
+    my $score = $detector->get_score($detector->detect(\@files));
+    my @clones = map { @{$_->{set}} } @{$score->{clone_set_score}};
+    ok((grep { $_->{start_line} <= 5 && $_->{end_line} >= 10 } @clones), 'reports the foreach block')
+        or diag explain \@clones;
+    ok(!(grep { $_->{start_line} >= 6 && $_->{end_line} <= 9 } @clones), 'does not report the statements in it again')
+        or diag explain \@clones;
+};
+
+done_testing;
@@ -0,0 +1,25 @@
+#!/usr/bin/env perl
+use strict;
+use warnings;
+
+sub check1 {
+    my ($a, $b) = @_;
+    unless ($a) {
+        $b = $b + 1;
+        $b = $b * 2;
+        $b = $b - 3;
+        print "$b\n";
+    }
+    return $b;
+}
+
+sub check2 {
+    my ($a, $b) = @_;
+    if (!$a) {
+        $b = $b + 1;
+        $b = $b * 2;
+        $b = $b - 3;
+        print "$b\n";
+    }
+    return $b;
+}